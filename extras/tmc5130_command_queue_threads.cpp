@@ -0,0 +1,94 @@
+/*
+ * Host check of tmc5130_command_queue with one producer thread and one consumer thread, without hardware.
+ *
+ * The producer submits numbered positioning moves as fast as the queue accepts them, while the consumer drains them into a fake driver
+ * which records the XTARGET writes. The check fails if a move is lost, duplicated or executed out of order.
+ *
+ * Build and run from the root of the library:
+ *   g++ -std=gnu++11 -O2 -pthread -Wno-packed-bitfield-compat -Isrc extras/tmc5130_command_queue_threads.cpp src/tmc5130.cpp src/tmc5130_command_queue.cpp -o command_queue_threads && ./command_queue_threads
+ */
+
+/* Library header */
+#include "tmc5130_command_queue.h"
+
+/* C/C++ libraries */
+#include <stdio.h>
+#include <thread>
+
+/* Number of moves submitted, their targets cycle below 2^16 steps so they are exact as floats */
+#define COMMANDS_COUNT 2000000
+#define TARGETS_COUNT 60000
+
+/**
+ * Driver that only checks the sequence of targets written to XTARGET.
+ */
+class tmc5130_sequence_fake : public tmc5130 {
+
+   public:
+    unsigned long received = 0;  //!< Number of targets received
+    unsigned long errors = 0;    //!< Number of targets that were not the expected one
+
+    int status_read(uint8_t &status) {
+        status = 0;
+        return 0;
+    }
+
+    int register_read(const uint8_t, uint32_t &data) {
+        data = 0;
+        return 0;
+    }
+
+    int register_write(const uint8_t address, const uint32_t data) {
+        if (address == XTARGET) {
+            uint32_t expected = (received % TARGETS_COUNT) * 256;
+            if (data != expected) {
+                if (errors < 10) {
+                    fprintf(stderr, "FAIL: move %lu targets %u, expected %u\n", received, data / 256, expected / 256);
+                }
+                errors++;
+            }
+            received++;
+        }
+        return 0;
+    }
+};
+
+int main(void) {
+    static tmc5130_command_queue queue;
+    static tmc5130_sequence_fake driver;
+    unsigned long full = 0;
+
+    /* Producer */
+    std::thread producer([&full]() {
+        for (unsigned long i = 0; i < COMMANDS_COUNT; i++) {
+            struct tmc5130_command_queue::command command = {tmc5130_command_queue::COMMAND_MOVE_TO_POSITION, (float)(i % TARGETS_COUNT)};
+            while (queue.submit(command) == -ENOSPC) {
+                full++;
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    /* Consumer */
+    std::thread consumer([]() {
+        while (driver.received < COMMANDS_COUNT) {
+            int res = queue.process(driver);
+            if (res < 0) {
+                driver.errors++;
+            } else if (res == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    producer.join();
+    consumer.join();
+
+    /* Nothing must be left over */
+    if (queue.pending_count() != 0) {
+        fprintf(stderr, "FAIL: %zu commands left in the queue\n", queue.pending_count());
+        driver.errors++;
+    }
+    printf("%lu moves received, queue found full %lu times, %lu errors\n", driver.received, full, driver.errors);
+    return (driver.errors == 0 && driver.received == COMMANDS_COUNT) ? 0 : 1;
+}
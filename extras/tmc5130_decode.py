@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Decodes frames produced by tmc5130_recorder into csv.
+
+Usage: tmc5130_decode.py [capture.bin] > capture.csv
+Reads from stdin when no file is given.
+Times are unwrapped, so they keep increasing when the 32-bit microsecond counter of the recorder wraps around.
+"""
+
+import sys
+
+SYNC_DELTA = 0xA5
+SYNC_KEY = 0xA6
+
+# Register names, and the width of the registers holding a signed value
+REGISTERS = {
+    0x12: ("TSTEP", None),
+    0x21: ("XACTUAL", 32),
+    0x22: ("VACTUAL", 24),
+    0x2D: ("XTARGET", 32),
+    0x35: ("RAMP_STAT", None),
+    0x36: ("XLATCH", 32),
+    0x6F: ("DRV_STATUS", None),
+    0x71: ("PWM_SCALE", None),
+}
+
+
+def varint_decode(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    value &= 0xFFFFFFFF
+    return (value >> 1) ^ -(value & 1), offset
+
+
+def register_format(address, raw):
+    raw &= 0xFFFFFFFF
+    width = REGISTERS.get(address, (None, None))[1]
+    if width is not None:
+        raw &= (1 << width) - 1
+        if raw & (1 << (width - 1)):
+            raw -= 1 << width
+    return raw
+
+
+def frames_decode(data):
+    """Yields (time_us, addresses, values) for each valid frame, skipping garbage until a key frame.
+
+    Key frames carry the 32-bit time, delta frames the time elapsed since the previous frame.
+    Both are unwrapped against the previous time, as the elapsed time between two frames is less than 2^32 us.
+    """
+    addresses = None
+    values = None
+    time = 0
+    offset = 0
+    while offset + 3 <= len(data):
+        sync = data[offset]
+        if sync not in (SYNC_DELTA, SYNC_KEY):
+            offset += 1
+            continue
+        length = data[offset + 1]
+        end = offset + 2 + length
+        if end >= len(data):
+            break
+        payload = data[offset + 2:end]
+        if sum(payload) & 0xFF != data[end]:
+            offset += 1
+            continue
+        try:
+            position = 0
+            if sync == SYNC_KEY:
+                count = payload[0]
+                frame_addresses = list(payload[1:1 + count])
+                position = 1 + count
+                key_time, position = varint_decode(payload, position)
+                if addresses is None:
+                    frame_time = key_time & 0xFFFFFFFF
+                else:
+                    frame_time = time + ((key_time - time) & 0xFFFFFFFF)
+                reference = [0] * count
+            else:
+                if addresses is None:
+                    offset += 1
+                    continue
+                frame_addresses = addresses
+                elapsed, position = varint_decode(payload, position)
+                frame_time = time + (elapsed & 0xFFFFFFFF)
+                reference = values
+            frame_values = []
+            for i in range(len(frame_addresses)):
+                delta, position = varint_decode(payload, position)
+                frame_values.append((reference[i] + delta) & 0xFFFFFFFF)
+            if position != len(payload):
+                raise IndexError
+        except IndexError:
+            offset += 1
+            continue
+        addresses, values, time = frame_addresses, frame_values, frame_time
+        offset = end + 1
+        yield time, addresses, values
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    header = None
+    for time, addresses, values in frames_decode(data):
+        if header != addresses:
+            header = addresses
+            names = [REGISTERS.get(a, ("0x%02X" % a, None))[0] for a in addresses]
+            print(",".join(["time_us"] + names))
+        print(",".join([str(time)] + [str(register_format(a, v)) for a, v in zip(addresses, values)]))
+
+
+if __name__ == "__main__":
+    main()
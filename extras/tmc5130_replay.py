@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Replays a bus trace recorded by tmc5130_trace against a simulated TMC5130 register file.
+
+Usage: tmc5130_replay.py trace.bin [--compare other.bin] [--csv]
+
+The replay reports:
+- reads of configuration registers that do not match what was last written, which reveal resets or corrupted accesses,
+- failed accesses and status byte flags,
+- bus traffic per register, including writes that did not change the register value,
+- the number of datagrams, pipelined reads of batches taking one datagram and other reads two.
+With --compare, the traffic of two traces is compared, for example before and after a firmware change.
+"""
+
+import argparse
+import struct
+import sys
+from collections import Counter
+
+RECORD = struct.Struct("<IBBBI")
+
+FLAG_WRITE = 0x01
+FLAG_STATUS = 0x02
+FLAG_ERROR = 0x04
+FLAG_PIPELINED = 0x08
+
+# Register names
+NAMES = {
+    0x00: "GCONF", 0x01: "GSTAT", 0x02: "IFCNT", 0x03: "SLAVECONF", 0x04: "IO_INPUT_OUTPUT", 0x05: "X_COMPARE",
+    0x10: "IHOLD_IRUN", 0x11: "TPOWERDOWN", 0x12: "TSTEP", 0x13: "TPWMTHRS", 0x14: "TCOOLTHRS", 0x15: "THIGH",
+    0x20: "RAMPMODE", 0x21: "XACTUAL", 0x22: "VACTUAL", 0x23: "VSTART", 0x24: "A1", 0x25: "V1", 0x26: "AMAX",
+    0x27: "VMAX", 0x28: "DMAX", 0x2A: "D1", 0x2B: "VSTOP", 0x2C: "TZEROWAIT", 0x2D: "XTARGET",
+    0x33: "VDCMIN", 0x34: "SW_MODE", 0x35: "RAMP_STAT", 0x36: "XLATCH",
+    0x6A: "MSCNT", 0x6C: "CHOPCONF", 0x6D: "COOLCONF", 0x6F: "DRV_STATUS", 0x70: "PWMCONF", 0x71: "PWM_SCALE",
+}
+
+# Registers that keep the value written to them and can be read back
+CONFIGURATION = {0x00, 0x20, 0x2D, 0x34, 0x6C}
+
+# Status byte flags
+STATUS_FLAGS = {0x01: "reset_flag", 0x02: "driver_error", 0x04: "sg2", 0x08: "standstill"}
+
+
+def name(address):
+    return NAMES.get(address, "0x%02X" % address)
+
+
+def records_load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) % RECORD.size:
+        print("warning: %s ends with a partial record" % path, file=sys.stderr)
+    return [RECORD.unpack_from(data, offset) for offset in range(0, len(data) - RECORD.size + 1, RECORD.size)]
+
+
+def replay(records, verbose=True):
+    """Replays records against a simulated register file, returns traffic statistics."""
+    registers = {}
+    reads = Counter()
+    writes = Counter()
+    redundant = Counter()
+    status_flags = Counter()
+    errors = 0
+    mismatches = 0
+    datagrams = 0
+
+    for timestamp, address, flags, status, value in records:
+        for mask, flag in STATUS_FLAGS.items():
+            if status & mask and not flags & FLAG_ERROR:
+                status_flags[flag] += 1
+        if flags & FLAG_ERROR:
+            errors += 1
+            if verbose:
+                print("%10u us  error accessing %s" % (timestamp, name(address)))
+            continue
+        if flags & FLAG_STATUS:
+            datagrams += 1
+            continue
+        if flags & FLAG_WRITE:
+            datagrams += 1
+            writes[address] += 1
+            if registers.get(address) == value:
+                redundant[address] += 1
+            registers[address] = value
+        else:
+            # A pipelined read of a batch takes one datagram, its data coming with the next access,
+            # other reads take a second datagram to retrieve their data, so n reads of a batch take n + 1 datagrams
+            datagrams += 1 if flags & FLAG_PIPELINED else 2
+            reads[address] += 1
+            if address in CONFIGURATION and address in registers and registers[address] != value:
+                mismatches += 1
+                if verbose:
+                    print("%10u us  %s read 0x%08X, expected 0x%08X" % (timestamp, name(address), value, registers[address]))
+            registers[address] = value
+
+    duration = (records[-1][0] - records[0][0]) if records else 0
+    return {
+        "records": len(records),
+        "duration_us": duration,
+        "reads": reads,
+        "writes": writes,
+        "redundant": redundant,
+        "status_flags": status_flags,
+        "errors": errors,
+        "mismatches": mismatches,
+        "datagrams": datagrams,
+    }
+
+
+def report(path, stats):
+    print("%s: %d records over %u us, %d datagrams (%d bytes), %d errors, %d mismatches" % (
+        path, stats["records"], stats["duration_us"], stats["datagrams"], stats["datagrams"] * 5, stats["errors"], stats["mismatches"]))
+    addresses = sorted(set(stats["reads"]) | set(stats["writes"]))
+    print("  %-16s %8s %8s %10s" % ("register", "reads", "writes", "redundant"))
+    for address in addresses:
+        print("  %-16s %8d %8d %10d" % (name(address), stats["reads"][address], stats["writes"][address], stats["redundant"][address]))
+    if stats["status_flags"]:
+        print("  status flags seen: " + ", ".join("%s x%d" % item for item in sorted(stats["status_flags"].items())))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("trace")
+    parser.add_argument("--compare", help="second trace to compare the traffic with")
+    parser.add_argument("--csv", action="store_true", help="dump the records as csv instead of replaying them")
+    args = parser.parse_args()
+
+    records = records_load(args.trace)
+    if args.csv:
+        print("timestamp_us,register,direction,status,value")
+        for timestamp, address, flags, status, value in records:
+            direction = "status" if flags & FLAG_STATUS else "write" if flags & FLAG_WRITE else "read"
+            if flags & FLAG_PIPELINED:
+                direction += " pipelined"
+            if flags & FLAG_ERROR:
+                direction += " error"
+            print("%u,%s,%s,0x%02X,0x%08X" % (timestamp, name(address), direction, status, value))
+        return
+
+    stats = replay(records)
+    report(args.trace, stats)
+    if args.compare:
+        other = replay(records_load(args.compare), verbose=False)
+        report(args.compare, other)
+        if stats["datagrams"]:
+            change = 100.0 * (other["datagrams"] - stats["datagrams"]) / stats["datagrams"]
+            print("traffic change: %+.1f%% datagrams" % change)
+
+
+if __name__ == "__main__":
+    main()
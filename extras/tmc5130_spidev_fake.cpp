@@ -0,0 +1,139 @@
+/*
+ * Fake spidev device for tmc5130_spidev, to check the transport on a Linux host without hardware.
+ *
+ * The fake replaces the file descriptor layer through tmc5130_spidev_io, emulates the register file and the pipelined
+ * read responses of a TMC5130, and checks every SPI_IOC_MESSAGE it receives:
+ * - no more than TMC5130_SPIDEV_FRAMES_MAX datagrams per ioctl, so larger batches must be split,
+ * - 5 byte datagrams, with cs_change set between datagrams and cleared on the last one,
+ * - no delay_usecs, which would run with chip select still asserted, the gap after read requests coming from cs_change.
+ *
+ * Build and run from the root of the library:
+ *   g++ -std=gnu++11 -Wno-packed-bitfield-compat -Isrc extras/tmc5130_spidev_fake.cpp src/tmc5130.cpp src/tmc5130_spidev.cpp -o spidev_fake && ./spidev_fake
+ */
+
+/* Library header */
+#include "tmc5130_spidev.h"
+
+/* C/C++ libraries */
+#include <linux/spi/spidev.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+
+/**
+ * Emulates a TMC5130 behind a spidev file descriptor.
+ */
+class tmc5130_spidev_fake : public tmc5130_spidev_io {
+
+   public:
+    uint32_t registers[128] = {0};
+    size_t messages = 0;        //!< Number of SPI_IOC_MESSAGE ioctls received
+    size_t frames_largest = 0;  //!< Largest number of datagrams received in one ioctl
+    size_t errors = 0;          //!< Number of checks that failed
+
+    int open(const char *const, const int) {
+        return 3;
+    }
+
+    int close(const int) {
+        return 0;
+    }
+
+    int ioctl(const int, const unsigned long request, void *const argument) {
+
+        /* Accept the configuration requests */
+        if (_IOC_TYPE(request) != SPI_IOC_MAGIC || _IOC_NR(request) != 0) {
+            return 0;
+        }
+
+        /* Check message size */
+        struct spi_ioc_transfer *transfers = (struct spi_ioc_transfer *)argument;
+        size_t frames = _IOC_SIZE(request) / sizeof(struct spi_ioc_transfer);
+        messages++;
+        if (frames > frames_largest) frames_largest = frames;
+        check(frames >= 1 && frames <= TMC5130_SPIDEV_FRAMES_MAX, "datagrams per ioctl within TMC5130_SPIDEV_FRAMES_MAX");
+
+        for (size_t i = 0; i < frames; i++) {
+            const uint8_t *tx = (const uint8_t *)(unsigned long)transfers[i].tx_buf;
+            uint8_t *rx = (uint8_t *)(unsigned long)transfers[i].rx_buf;
+            const bool write = (tx[0] & 0x80) != 0;
+            uint8_t address = tx[0] & 0x7F;
+
+            /* Check datagram framing */
+            check(transfers[i].len == 5, "datagram length of 5 bytes");
+            check(transfers[i].cs_change == ((i + 1 < frames) ? 1 : 0), "cs_change between datagrams only");
+            check(transfers[i].delay_usecs == 0, "no delay with chip select asserted");
+
+            /* Answer with the status and the data latched by the previous read request */
+            rx[0] = 0x00;
+            rx[1] = m_latched >> 24;
+            rx[2] = m_latched >> 16;
+            rx[3] = m_latched >> 8;
+            rx[4] = m_latched;
+
+            /* Perform the access */
+            uint32_t data = ((uint32_t)tx[1] << 24) | ((uint32_t)tx[2] << 16) | ((uint32_t)tx[3] << 8) | tx[4];
+            if (write) {
+                registers[address] = data;
+            } else {
+                m_latched = registers[address];
+            }
+        }
+        return 0;
+    }
+
+    void check(const bool condition, const char *const what) {
+        if (!condition) {
+            errors++;
+            fprintf(stderr, "FAIL: %s\n", what);
+        }
+    }
+
+   protected:
+    uint32_t m_latched = 0;
+};
+
+int main(void) {
+    tmc5130_spidev_fake fake;
+    tmc5130_spidev driver;
+    fake.registers[tmc5130::IO_INPUT_OUTPUT] = 0x11000000;
+
+    /* Setup through the fake */
+    if (driver.setup(NULL, 0, "/dev/fake", 4000000, &fake) < 0) {
+        fake.check(false, "setup");
+    }
+
+    /* A batch larger than one ioctl, mixing reads and writes, must be split in chunks of TMC5130_SPIDEV_FRAMES_MAX - 1 accesses */
+    const size_t count = 2 * TMC5130_SPIDEV_FRAMES_MAX + 5;
+    struct tmc5130::access accesses[count];
+    for (size_t i = 0; i < count; i++) {
+        fake.registers[i % 64] = 0x1000 + i % 64;
+        accesses[i].address = i % 64;
+        accesses[i].write = (i % 3 == 0);
+        accesses[i].data = accesses[i].write ? 0x2000 + i : 0;
+    }
+    size_t messages = fake.messages;
+    if (driver.register_batch(accesses, count) < 0) {
+        fake.check(false, "register_batch");
+    }
+    size_t chunks = (count + TMC5130_SPIDEV_FRAMES_MAX - 2) / (TMC5130_SPIDEV_FRAMES_MAX - 1);
+    fake.check(fake.messages - messages == chunks, "one ioctl per chunk of TMC5130_SPIDEV_FRAMES_MAX - 1 accesses");
+
+    /* Reads return the register value at the time of the read, including writes done earlier in the same batch */
+    uint32_t expected[64];
+    for (size_t i = 0; i < 64; i++) expected[i] = 0x1000 + i;
+    for (size_t i = 0; i < count; i++) {
+        if (accesses[i].write) {
+            expected[accesses[i].address] = accesses[i].data;
+        } else {
+            fake.check(accesses[i].data == expected[accesses[i].address], "pipelined read data");
+        }
+    }
+
+    /* Single accesses */
+    uint32_t data = 0;
+    fake.check(driver.register_write(tmc5130::VMAX, 1234) == 0, "register_write");
+    fake.check(driver.register_read(tmc5130::VMAX, data) == 0 && data == 1234, "register_read");
+
+    printf("%zu ioctl messages, at most %zu datagrams each, %zu errors\n", fake.messages, fake.frames_largest, fake.errors);
+    return (fake.errors == 0) ? 0 : 1;
+}
@@ -1,567 +1,306 @@
 /* Self header */
 #include "tmc5130.h"
 
+/* Default register settings, written at setup unless overriden
+ * The ramp registers are included because the datasheet explicitely says that D1 and VSTOP should not be set to 0 */
+static const struct tmc5130::setting tmc5130_settings_default[] PROGMEM = {
+    {tmc5130::CHOPCONF, 0x000100C3},    // CHOPCONF: TOFF=3, HSTRT=4, HEND=1, TBL=2, CHM=0 (SpreadCycle)
+    {tmc5130::IHOLD_IRUN, 0x00061F0A},  // IHOLD_IRUN: IHOLD=10, IRUN=31 (max. current), IHOLDDELAY=6
+    {tmc5130::TPOWERDOWN, 0x0000000A},  // TPOWERDOWN=10: Delay before power down in stand still
+    {tmc5130::GCONF, 0x00000004},       // EN_PWM_MODE=1 enables StealthChop (with default PWMCONF)
+    {tmc5130::TPWMTHRS, 0x000001F4},    // TPWM_THRS=500 yields a switching velocity about 35000 = ca. 30RPM
+    {tmc5130::PWMCONF, 0x000401C8},     // PWMCONF: AUTO=1, 2/1024 Fclk, Switch amplitude limit=200, Grad=1
+    {tmc5130::TCOOLTHRS, 0},
+    {tmc5130::THIGH, 0},
+    {tmc5130::RAMPMODE, 0},
+    {tmc5130::VSTART, 0},
+    {tmc5130::V_1, 0},
+    {tmc5130::VSTOP, 10},
+    {tmc5130::VMAX, 100},
+    {tmc5130::AMAX, 10000},
+    {tmc5130::DMAX, 10000},
+    {tmc5130::A_1, 10000},
+    {tmc5130::D_1, 10000},
+};
+
+/* First quarter of a sine wave over 1024 steps per electrical period, scaled to 255 */
+static const uint8_t tmc5130_sine_quarter[257] PROGMEM = {
+    0, 2, 3, 5, 6, 8, 9, 11, 13, 14, 16, 17, 19, 20, 22, 23,
+    25, 27, 28, 30, 31, 33, 34, 36, 37, 39, 41, 42, 44, 45, 47, 48,
+    50, 51, 53, 54, 56, 57, 59, 60, 62, 63, 65, 67, 68, 70, 71, 73,
+    74, 76, 77, 79, 80, 81, 83, 84, 86, 87, 89, 90, 92, 93, 95, 96,
+    98, 99, 100, 102, 103, 105, 106, 108, 109, 110, 112, 113, 115, 116, 117, 119,
+    120, 122, 123, 124, 126, 127, 128, 130, 131, 132, 134, 135, 136, 138, 139, 140,
+    142, 143, 144, 146, 147, 148, 149, 151, 152, 153, 154, 156, 157, 158, 159, 161,
+    162, 163, 164, 165, 167, 168, 169, 170, 171, 172, 174, 175, 176, 177, 178, 179,
+    180, 181, 183, 184, 185, 186, 187, 188, 189, 190, 191, 192, 193, 194, 195, 196,
+    197, 198, 199, 200, 201, 202, 203, 204, 205, 206, 207, 208, 208, 209, 210, 211,
+    212, 213, 214, 215, 215, 216, 217, 218, 219, 220, 220, 221, 222, 223, 223, 224,
+    225, 226, 226, 227, 228, 228, 229, 230, 231, 231, 232, 232, 233, 234, 234, 235,
+    236, 236, 237, 237, 238, 238, 239, 240, 240, 241, 241, 242, 242, 243, 243, 244,
+    244, 244, 245, 245, 246, 246, 247, 247, 247, 248, 248, 248, 249, 249, 249, 250,
+    250, 250, 251, 251, 251, 252, 252, 252, 252, 252, 253, 253, 253, 253, 253, 254,
+    254, 254, 254, 254, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255,
+};
+
 /**
  *
- * @param[in] config
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
- *  -ENODEV If the device was not detected
+ * @return The amount of ram used by this instance, in bytes.
  */
-int tmc5130::setup(struct config &config) {
-    int res;
-
-    /* Ensure driver is dectected and has the expected version */
-    union reg_io_input_output reg_io_input_output = {0};
-    res = register_read(reg::IO_INPUT_OUTPUT, reg_io_input_output.raw);
-    if (res < 0) {
-        return -EIO;
-    }
-    if (reg_io_input_output.fields.version != 0x11) {
-        return -ENODEV;
-    }
-
-    /* Clear the reset and charge pump undervoltage flags */
-    union reg_gstat reg_gstat = {0};
-    reg_gstat.fields.reset = 1;
-    reg_gstat.fields.uv_cp = 1;
-    res = register_write(reg::GSTAT, reg_gstat.raw);
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Write configuration registers */
-    res = 0;
-    res |= register_write(reg::CHOPCONF, config.reg_chopconf.raw);
-    res |= register_write(reg::IHOLD_IRUN, config.reg_ihold_irun.raw);
-    res |= register_write(reg::TPOWERDOWN, config.reg_tpowerdown.raw);
-    res |= register_write(reg::GCONF, config.reg_gconf.raw);
-    res |= register_write(reg::TPWMTHRS, config.reg_tpwmthrs.raw);
-    res |= register_write(reg::PWMCONF, config.reg_pwmconf.raw);
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Set default speeds
-     * This is done at least here because the datasheet explicitely says that D1 and VSTOP should not be set to 0 */
-    res = 0;
-    res |= register_write(reg::RAMPMODE, 0);
-    res |= register_write(reg::VSTART, 0);
-    res |= register_write(reg::V_1, 0);
-    res |= register_write(reg::VSTOP, 10);
-    res |= register_write(reg::VMAX, 100);
-    res |= register_write(reg::AMAX, 10000);
-    res |= register_write(reg::DMAX, 10000);
-    res |= register_write(reg::A_1, 10000);
-    res |= register_write(reg::D_1, 10000);
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+size_t tmc5130::footprint_ram_get(void) const {
+    return sizeof(*this);
 }
 
 /**
  *
- * @param[in] vstart
- * @param[in] vstop
- * @param[in] vtrans
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * @return The amount of flash used by the default settings table, shared between all instances, in bytes.
  */
-int tmc5130::speed_ramp_set(const float vstart, const float vstop, const float vtrans) {
-    int res;
-
-    /*  */
-    res = 0;
-    res |= register_write(reg::VSTART, convert_velocity_to_tmc(fabs(vstart)));
-    res |= register_write(reg::VSTOP, convert_velocity_to_tmc(fabs(vstop)));
-    res |= register_write(reg::V_1, convert_velocity_to_tmc(fabs(vtrans)));
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+size_t tmc5130_common::footprint_table_get(void) {
+    return sizeof(tmc5130_settings_default);
 }
 
 /**
- *
- * @param[in] speed
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * Gives access to the default register settings.
+ * @param[out] count The number of settings in the table.
+ * @return The table, stored in flash on platforms that have PROGMEM.
  */
-int tmc5130::speed_limit_set(const float speed) {
-    int res;
-
-    /* Ensure speed is positive */
-    if (speed < 0) {
-        return -EINVAL;
-    }
-
-    /* Write register */
-    res = 0;
-    res |= register_write(reg::VMAX, convert_velocity_to_tmc(speed));
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+const struct tmc5130_common::setting *tmc5130_common::settings_default_get(size_t &count) {
+    count = sizeof(tmc5130_settings_default) / sizeof(tmc5130_settings_default[0]);
+    return tmc5130_settings_default;
 }
 
 /**
- *
- * @param[in] acceleration
+ * Performs a sequence of register accesses.
+ * This default implementation simply issues the accesses one after the other, transports that can do better should override it.
+ * @param[in,out] accesses The accesses to perform, the data of read accesses is filled in.
+ * @param[in] count The number of accesses.
  * @return 0 in case of success, or a negative error code otherwise, in particular:
  *  -EIO If there was an error communicating with the device
  */
-int tmc5130::acceleration_limit_set(const float acceleration) {
-    int res;
-
-    /* Ensure acceleration is positive */
-    if (acceleration < 0) {
-        return -EINVAL;
-    }
-
-    /* Write registers  */
-    res = 0;
-    res |= register_write(reg::AMAX, convert_acceleration_to_tmc(acceleration));
-    res |= register_write(reg::DMAX, convert_acceleration_to_tmc(acceleration));
-    res |= register_write(reg::A_1, convert_acceleration_to_tmc(acceleration));
-    res |= register_write(reg::D_1, convert_acceleration_to_tmc(acceleration));
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+int tmc5130::register_batch(struct access *const accesses, const size_t count) {
+    return tmc5130_base<tmc5130>::register_batch(accesses, count);
 }
 
 /**
- *
- * @param[in] position
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * Installs a lock that serializes every access to this driver.
+ * @param[in] lock The lock, which must be recursive, or NULL to disable locking.
  */
-int tmc5130::move_to_position(const float position) {
-    int res;
-
-    /* Set RAMPMODE to Positioning mode */
-    res = register_write(reg::RAMPMODE, 0x00);
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Set XTARGET */
-    int32_t reg_xtarget = roundf(position * m_ustep_per_step);
-    res = register_write(reg::XTARGET, (uint32_t)reg_xtarget);
-    if (res < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+void tmc5130_common::lock_set(tmc5130_lock *const lock) {
+    m_lock = lock;
 }
 
 /**
- *
- * @param[in] velocity
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * Enables the extended position and modulo axis functions, which keep their state in the given structure.
+ * The extended position starts from XACTUAL at the next read, and the axis is linear until position_modulo_set is called.
+ * @param[in] tracking The state, which must remain valid as long as the driver is used, or NULL to disable these functions.
  */
-int tmc5130::move_at_velocity(const float velocity) {
-    int res;
-
-    /* */
-    res |= register_write(reg::VMAX, convert_velocity_to_tmc(fabs(velocity)));
-    res |= register_write(reg::RAMPMODE, velocity < 0.0f ? 2 : 1);
-    if (res < 0) {
-        return -EIO;
+void tmc5130_common::position_tracking_attach(struct position_tracking *const tracking) {
+    m_position = tracking;
+    if (m_position != NULL) {
+        m_position->tracked = false;
+        m_position->xactual = 0;
+        m_position->extended = 0;
+        m_position->modulo = 0;
     }
-
-    /* Return success */
-    return 0;
 }
 
 /**
- *
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * Enables microstep_resolution_set and microstep_auto_set, which keep their state in the given structure.
+ * This should be done before setup, so that the ramp registers written from there on are remembered for rescaling.
+ * If it is done later, the resolution cannot be switched until each ramp register has been written again, such as by setup.
+ * @param[in] switching The state, which must remain valid as long as the driver is used, or NULL to disable these functions.
  */
-int tmc5130::move_stop(void) {
-
-    /* For a stop in positioning mode, set VSTART=0 and VMAX=0 */
-    int res = 0;
-    res |= register_write(reg::VSTART, 0);
-    res |= register_write(reg::VMAX, 0);
-    if (res != 0) {
-        return -EIO;
+void tmc5130_common::microstep_switching_attach(struct microstep_switching *const switching) {
+    m_microstep = switching;
+    if (m_microstep != NULL) {
+        memset(m_microstep->ramp, 0, sizeof(m_microstep->ramp));
+        m_microstep->valid = 0;
+        m_microstep->mres_base = m_mres;
+        m_microstep->auto_mres = m_mres;
+        m_microstep->auto_speed = 0;
     }
-
-    /* Return success */
-    return 0;
 }
 
 /**
  *
- * @param[out] position
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * @see Datasheet, section 14.1 Real World Unit Conversion
  */
-int tmc5130::position_current_get(float &position) {
-    uint32_t reg_xactual;
-    if (register_read(reg::XACTUAL, reg_xactual) < 0) {
-        return -EIO;
-    }
-    position = (int32_t)reg_xactual;
-    position /= m_ustep_per_step;
-    return 0;
+uint32_t tmc5130_common::convert_velocity_to_tmc(const float velocity) {
+    return (int32_t)(velocity / ((float)m_fclk / (float)(1ul << 24)) * (float)ustep_per_step());
 }
 
 /**
  *
- * @param[out] position
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * @see Datasheet, section 14.1 Real World Unit Conversion
  */
-int tmc5130::position_latched_get(float &position) {
-    int32_t position_ustep;
-    uint32_t reg_xlatch;
-    if (register_read(reg::XLATCH, reg_xlatch) < 0) {
-        return -EIO;
-    }
-    position = (int32_t)reg_xlatch;
-    position /= m_ustep_per_step;
-    return 0;
+uint32_t tmc5130_common::convert_acceleration_to_tmc(const float acceleration) {
+    return (int32_t)(acceleration / ((float)m_fclk * (float)m_fclk / (512.0 * 256.0) / (float)(1ul << 24)) * (float)ustep_per_step());
 }
 
 /**
  *
- * @return 1 if the target position has been reached, 0 if it has not, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * @see Datasheet, section 14.1 Real World Unit Conversion
  */
-int tmc5130::target_position_reached_is(void) {
-
-    /* Read bit 9 position_reached of RAMP_STAT
-     * 1: Signals, that the target position is reached. This flag becomes set while XACTUAL and XTARGET match */
-    uint32_t reg_ramp_status;
-    if (register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
-        return -EIO;
-    }
-
-    /* Remember flags that are cleared upon reading */
-    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
-    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
-
-    /* Return wether the target is reached */
-    if (reg_ramp_status & (1 << 9)) {
-        return 1;
-    } else {
-        return 0;
-    }
+float tmc5130_common::convert_velocity_from_tmc(const int32_t velocity) {
+    return (float)velocity * ((float)m_fclk / (float)(1ul << 24)) / (float)ustep_per_step();
 }
 
 /**
- *
- * @return 1 if the target velocity has been reached, 0 if it has not, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * Accumulates the difference between two reads of XACTUAL into the extended position, taking care of it wrapping around.
+ * Nothing is done if no extended position state is attached.
+ * @param[in] xactual The value of XACTUAL just read.
  */
-int tmc5130::target_velocity_reached_is(void) {
-
-    /* Read bit 8 velocity_reached of RAMP_STAT
-     * 1: Signals, that the target velocity is reached. This flag becomes set while VACTUAL and VMAX match. */
-    uint32_t reg_ramp_status;
-    if (register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
-        return -EIO;
+void tmc5130_common::position_track(const uint32_t xactual) {
+    if (m_position == NULL) {
+        return;
     }
-
-    /* Remember flags that are cleared upon reading */
-    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
-    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
-
-    /* Return wether the target is reached */
-    if (reg_ramp_status & (1 << 8)) {
-        return 1;
+    if (m_position->tracked) {
+        m_position->extended += (int64_t)(int32_t)(xactual - m_position->xactual) * (1 << m_mres);
     } else {
-        return 0;
+        m_position->extended = (int64_t)(int32_t)xactual * (1 << m_mres);
+        m_position->tracked = true;
     }
+    m_position->xactual = xactual;
 }
 
 /**
- *
- * @param[in] swap
- * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ * Gives the index of a ramp register in microstep_switching::ramp, which skips the unused address 0x29.
+ * @param[in] address
+ * @return The index from 0 to 7, or -1 if the address is not one of the write only ramp registers.
  */
-int tmc5130::reference_swap(bool swap) {
-
-    /* Set bit 4 of SW_MODE
-     * 1: Swap the left and the right reference switch input REFL and REFR */
-    uint32_t reg_sw_mode;
-    if (register_read(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
+int8_t tmc5130_common::ramp_index(const uint8_t address) {
+    if (address >= VSTART && address <= DMAX) {
+        return address - VSTART;
+    } else if (address == D_1 || address == VSTOP) {
+        return address - VSTART - 1;
     }
-    if (swap) {
-        reg_sw_mode |= (1 << 4);
-    } else {
-        reg_sw_mode &= ~(1 << 4);
-    }
-    if (register_write(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+    return -1;
 }
 
 /**
- *
- * @param[in] active_high
+ * Converts a number of microsteps per step into the value of CHOPCONF.mres.
+ * @param[in] microsteps The number of microsteps per step, a power of two from 1 to 256.
+ * @param[out] mres
  * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ *  -EINVAL If the number of microsteps is not valid
  */
-int tmc5130::reference_l_polarity_set(bool active_high) {
-
-    /* Set bit 2 of SW_MODE
-     * Sets the active polarity of the left reference switch input
-     * 0=non-inverted, high active: a high level on REFL stops the motor
-     * 1=inverted, low active: a low level on REFL stops the motor */
-    uint32_t reg_sw_mode;
-    if (register_read(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
-    }
-    if (active_high) {
-        reg_sw_mode &= ~(1 << 2);
-    } else {
-        reg_sw_mode |= (1 << 2);
-    }
-    if (register_write(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
+int tmc5130_common::microsteps_to_mres(const uint16_t microsteps, uint8_t &mres) {
+    for (mres = 0; mres <= 8; mres++) {
+        if ((256 >> mres) == microsteps) {
+            return 0;
+        }
     }
-
-    /* Return success */
-    return 0;
+    return -EINVAL;
 }
 
 /**
- *
- * @param[in] active_high
+ * Converts a position in microsteps from one resolution to another, rounding down when the new resolution is coarser.
+ * @param[in] position
+ * @param[in] mres_from The resolution of the given position, as in CHOPCONF.mres.
+ * @param[in] mres_to The resolution to convert to, as in CHOPCONF.mres.
+ * @param[out] result
  * @return 0 in case of success, or a negative error code otherwise, in particular:
- *  -EIO If there was an error communicating with the device
+ *  -ERANGE If the result does not fit in 32 bits
  */
-int tmc5130::reference_r_polarity_set(bool active_high) {
-
-    /* Set bit 3 of SW_MODE
-     * Sets the active polarity of the right reference switch input
-     * 0=non-inverted, high active: a high level on REFR stops the motor
-     * 1=inverted, low active: a low level on REFR stops the motor */
-    uint32_t reg_sw_mode;
-    if (register_read(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
-    }
-    if (active_high) {
-        reg_sw_mode &= ~(1 << 3);
+int tmc5130_common::position_rescale(const int32_t position, const uint8_t mres_from, const uint8_t mres_to, int32_t &result) {
+    int64_t value = position;
+    if (mres_to > mres_from) {
+        int64_t divisor = (int64_t)1 << (mres_to - mres_from);
+        value = (value >= 0) ? (value / divisor) : -((-value + divisor - 1) / divisor);
     } else {
-        reg_sw_mode |= (1 << 3);
+        value *= (int64_t)1 << (mres_from - mres_to);
     }
-    if (register_write(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
+    if (value > INT32_MAX || value < INT32_MIN) {
+        return -ERANGE;
     }
-
-    /* Return success */
+    result = (int32_t)value;
     return 0;
 }
 
 /**
- *
+ * Converts the value of a ramp register from one resolution to another, rounding to nearest and saturating to the size of the register.
+ * Non zero values stay non zero, as VSTOP, D1 and the accelerations must not be 0.
+ * @param[in] address The ramp register, from VSTART to VSTOP.
+ * @param[in] value
+ * @param[in] mres_from The resolution of the given value, as in CHOPCONF.mres.
+ * @param[in] mres_to The resolution to convert to, as in CHOPCONF.mres.
+ * @return The converted value.
  */
-int tmc5130::reference_l_active_get(void) {
-
-    /* Read bit 0 status_stop_l of RAMP_STAT
-     * Reference switch left status (1=active) */
-    uint32_t reg_ramp_status;
-    if (register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
-        return -EIO;
-    }
-
-    /* Remember flags that are cleared upon reading */
-    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
-    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
-
-    /* Return wether the switch is active */
-    return (reg_ramp_status & (1 << 0)) ? 1 : 0;
-}
-
-/**
- *
- */
-int tmc5130::reference_r_active_get(void) {
-
-    /* Read bit 1 status_stop_r of RAMP_STAT
-     * Reference switch right status (1=active) */
-    uint32_t reg_ramp_status;
-    if (register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
-        return -EIO;
-    }
-
-    /* Remember flags that are cleared upon reading */
-    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
-    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
-
-    /* Return wether the switch is active */
-    return (reg_ramp_status & (1 << 1)) ? 1 : 0;
-}
-
-/**
- *
- * @param[in] polarity If true the position will be latched when the reference switch goes active, and conversely.
- */
-int tmc5130::reference_l_latch_enable(bool polarity) {
-
-    /* Reset flag */
-    m_reference_l_latched = false;
-
-    /* Set bit 6 and 5 of SW_MODE */
-    uint32_t reg_sw_mode;
-    if (register_read(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
-    }
-    if (polarity) {
-        reg_sw_mode &= ~(1 << 6);  // latch_l_inactive = 0
-        reg_sw_mode |= (1 << 5);   // latch_l_active = 1
+uint32_t tmc5130_common::ramp_rescale(const uint8_t address, const uint32_t value, const uint8_t mres_from, const uint8_t mres_to) {
+
+    /* Find out the largest value of the register */
+    uint32_t value_max;
+    switch (address) {
+        case VSTART:
+        case VSTOP:
+            value_max = 0x3FFFF;
+            break;
+        case V_1:
+            value_max = 0xFFFFF;
+            break;
+        case VMAX:
+            value_max = 0x7FFE00;
+            break;
+        default:
+            value_max = 0xFFFF;
+            break;
+    }
+
+    /* Rescale */
+    uint64_t result = value;
+    if (mres_to > mres_from) {
+        uint8_t shift = mres_to - mres_from;
+        result = (result + (1ul << (shift - 1))) >> shift;
     } else {
-        reg_sw_mode |= (1 << 6);   // latch_l_inactive = 1
-        reg_sw_mode &= ~(1 << 5);  // latch_l_active = 0
+        result <<= mres_from - mres_to;
     }
-    if (register_write(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
+    if (result > value_max) {
+        result = value_max;
     }
-
-    /* Return success */
-    return 0;
-}
-
-/**
- *
- * @param[in] polarity If true the position will be latched when the reference switch goes active, and conversely.
- */
-int tmc5130::reference_r_latch_enable(bool polarity) {
-
-    /* Reset flag */
-    m_reference_r_latched = false;
-
-    /* Set bit 8 and 7 of SW_MODE */
-    uint32_t reg_sw_mode;
-    if (register_read(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
-    }
-    if (polarity) {
-        reg_sw_mode &= ~(1 << 8);  // latch_r_inactive = 0
-        reg_sw_mode |= (1 << 7);   // latch_r_active = 1
-    } else {
-        reg_sw_mode |= (1 << 8);   // latch_r_inactive = 1
-        reg_sw_mode &= ~(1 << 7);  // latch_r_active = 0
+    if (result == 0 && value != 0) {
+        result = 1;
     }
-    if (register_write(reg::SW_MODE, reg_sw_mode) < 0) {
-        return -EIO;
-    }
-
-    /* Return success */
-    return 0;
+    return (uint32_t)result;
 }
 
 /**
- *
- * @param[out] position
- * @return 1 if the latched position is available, 0 if it is not, or a negative error code otherwise.
+ * Packs two coil currents into the XDIRECT register format.
+ * @param[in] coil_a
+ * @param[in] coil_b
+ * @return The XDIRECT register value.
  */
-int tmc5130::reference_l_latch_get(float &position) {
-
-    /* Read bit 2 status_latch_l of RAMP_STAT
-     * 1: Latch left ready */
-    uint32_t reg_ramp_status;
-    if (register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
-        return -EIO;
-    }
-
-    /* Remember flags that are cleared upon reading */
-    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
-    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
-
-    /* If latched position is available */
-    if (m_reference_l_latched) {
-
-        /* Retrieve position */
-        uint32_t reg_xlatch;
-        if (register_read(reg::XLATCH, reg_xlatch) < 0) {
-            return -EIO;
-        }
-        position = (int32_t)reg_xlatch;
-        position /= m_ustep_per_step;
-
-        /* Reset flag */
-        m_reference_l_latched = false;
-
-        /* Return success */
-        return 1;
-    } else {
-        return 0;
-    }
+uint32_t tmc5130_common::direct_pack(const int16_t coil_a, const int16_t coil_b) {
+    return ((uint32_t)(coil_a & 0x1FF)) | ((uint32_t)(coil_b & 0x1FF) << 16);
 }
 
 /**
- *
- * @param[out] position
- * @return 1 if the latched position is available, 0 if it is not, or a negative error code otherwise.
+ * Looks up a sine value from the quarter wave table, with integer math only.
+ * @param[in] phase The electrical angle, 1024 for a full period.
+ * @param[in] amplitude The peak value, from 0 to 255.
+ * @return The sine value, from -amplitude to amplitude.
  */
-int tmc5130::reference_r_latch_get(float &position) {
-
-    /* Read bit 3 status_latch_r of RAMP_STAT
-     * 1: Latch right ready */
-    uint32_t reg_ramp_status;
-    if (register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
-        return -EIO;
-    }
-
-    /* Remember flags that are cleared upon reading */
-    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
-    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
-
-    /* If latched position is available */
-    if (m_reference_r_latched) {
-
-        /* Retrieve position */
-        uint32_t reg_xlatch;
-        if (register_read(reg::XLATCH, reg_xlatch) < 0) {
-            return -EIO;
-        }
-        position = (int32_t)reg_xlatch;
-        position /= m_ustep_per_step;
-
-        /* Reset flag */
-        m_reference_r_latched = false;
-
-        /* Return success */
-        return 1;
-    } else {
-        return 0;
-    }
+int16_t tmc5130_common::direct_sine(const uint16_t phase, const uint8_t amplitude) {
+    uint16_t index = phase & 0xFF;
+    uint8_t quadrant = (phase >> 8) & 0x03;
+    uint8_t value = pgm_read_byte(&tmc5130_sine_quarter[(quadrant & 1) ? (256 - index) : index]);
+    int16_t scaled = ((uint16_t)value * amplitude + 127) / 255;
+    return (quadrant & 2) ? -scaled : scaled;
 }
 
 /**
- *
- * @see Datasheet, section 14.1 Real World Unit Conversion
+ * Converts a velocity into the time between two 1/256 microsteps, as used by TSTEP and the thresholds compared to it.
+ * @param[in] velocity The velocity in steps/s.
+ * @return The TSTEP value, saturated to 20 bits.
+ * @see Datasheet, section 6 TSTEP
  */
-uint32_t tmc5130::convert_velocity_to_tmc(const float velocity) {
-    return (int32_t)(velocity / ((float)m_fclk / (float)(1ul << 24)) * (float)m_ustep_per_step);
+uint32_t tmc5130_common::convert_velocity_to_tstep(const float velocity) {
+    float tstep = (float)m_fclk / (fabs(velocity) * 256.0f);
+    if (!(tstep < (float)0xFFFFF)) {
+        return 0xFFFFF;
+    }
+    return (uint32_t)tstep;
 }
 
-/**
- *
- * @see Datasheet, section 14.1 Real World Unit Conversion
- */
-uint32_t tmc5130::convert_acceleration_to_tmc(const float acceleration) {
-    return (int32_t)(acceleration / ((float)m_fclk * (float)m_fclk / (512.0 * 256.0) / (float)(1ul << 24)) * (float)m_ustep_per_step);
-}
+/* Runtime dispatched driver, compiled once here */
+template class tmc5130_base<tmc5130>;
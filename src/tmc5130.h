@@ -2,17 +2,81 @@
 #define TMC5130_H
 
 /* Arduino libraries */
+#if defined(ARDUINO)
 #include <Arduino.h>
 #include <SPI.h>
+#endif
 
 /* C/C++ libraries */
 #include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Optional bus trace, it changes the layout of the drivers so it must be defined for the whole build */
+#if defined(TMC5130_TRACE)
+#include "tmc5130_trace.h"
+#define TMC5130_TRACE_RECORD(address, flags, status, value)       \
+    do {                                                          \
+        if (this->m_trace != NULL) {                              \
+            this->m_trace->record(address, flags, status, value); \
+        }                                                         \
+    } while (0)
+#else
+#define TMC5130_TRACE_RECORD(address, flags, status, value) \
+    do {                                                   \
+    } while (0)
+#endif
+
+/* Flash storage, for platforms without it */
+#if !defined(ARDUINO)
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#endif
+
+/* Distance from 0 in microsteps beyond which the position of a modulo axis is rebased, float positions are exact up to 2^24 */
+#ifndef TMC5130_POSITION_REBASE_THRESHOLD
+#define TMC5130_POSITION_REBASE_THRESHOLD (1l << 24)
+#endif
 
 /**
- *
+ * Lock used to serialize accesses to a driver when it is shared between threads, tasks or interrupts.
+ * @note The lock must be recursive, as public functions acquire it and then call the register access functions which also acquire it.
+ * Typical implementations wrap a FreeRTOS recursive mutex or a std::recursive_mutex.
+ */
+class tmc5130_lock {
+
+   public:
+    virtual ~tmc5130_lock() {}
+    virtual void lock(void) = 0;
+    virtual void unlock(void) = 0;
+};
+
+/**
+ * Holds a lock for the duration of a scope, does nothing if there is no lock.
+ */
+class tmc5130_lock_guard {
+
+   public:
+    explicit tmc5130_lock_guard(tmc5130_lock *const lock) : m_lock(lock) {
+        if (m_lock != NULL) m_lock->lock();
+    }
+    ~tmc5130_lock_guard() {
+        if (m_lock != NULL) m_lock->unlock();
+    }
+
+   protected:
+    tmc5130_lock *const m_lock;
+};
+
+/**
+ * Register definitions and state shared by all forms of the driver, independent of the transport.
  * @note Use -Wno-packed-bitfield-compat
  */
-class tmc5130 {
+class tmc5130_common {
+
 
    public:
     /* Register addresses */
@@ -48,6 +112,7 @@ class tmc5130 {
         VSTOP = 0x2B,      // Motor stop velocity (unsigned). Attention: Set VSTOP > VSTART! Attention: Do not set 0 in positioning mode, minimum 10 recommend!
         TZEROWAIT = 0x2C,  // Waiting time after ramping down to zero velocity before next movement or direction inversion can start. Time range is about 0 to 2 seconds.
         XTARGET = 0x2D,    // Target position for ramp mode
+        XDIRECT = 0x2D,    // Direct coil currents, replaces XTARGET when GCONF.direct_mode is set
 
         /* Ramp generator driver feature control registers */
         VDCMIN = 0x33,     // Velocity threshold for enabling automatic commutation dcStep
@@ -56,8 +121,10 @@ class tmc5130 {
         XLATCH = 0x36,     // Ramp generator latch position upon programmable switch event
 
         /* Motor driver registers */
-        CHOPCONF = 0x6C,  // Chopper and driver configuration
-        PWMCONF = 0x70,   // Voltage PWM mode chopper configuration
+        CHOPCONF = 0x6C,    // Chopper and driver configuration
+        DRV_STATUS = 0x6F,  // stallGuard2 value and driver error flags
+        PWMCONF = 0x70,     // Voltage PWM mode chopper configuration
+        PWM_SCALE = 0x71,   // Actual PWM amplitude scaler in stealthChop
     };
 
     /* Register description */
@@ -130,6 +197,22 @@ class tmc5130 {
             uint8_t : 8;
         } __attribute__((packed)) fields;
     };
+    union reg_tcoolthrs {
+        uint32_t raw;
+        struct {
+            uint32_t tcoolthrs : 20;
+            uint8_t : 4;
+            uint8_t : 8;
+        } __attribute__((packed)) fields;
+    };
+    union reg_thigh {
+        uint32_t raw;
+        struct {
+            uint32_t thigh : 20;
+            uint8_t : 4;
+            uint8_t : 8;
+        } __attribute__((packed)) fields;
+    };
     union reg_ihold_irun {
         uint32_t raw;
         struct {
@@ -199,6 +282,24 @@ class tmc5130 {
             uint8_t stst : 1;
         } __attribute__((packed)) fields;
     };
+    union reg_pwm_scale {
+        uint32_t raw;
+        struct {
+            uint8_t pwm_scale_sum : 8;
+            uint8_t : 8;
+            uint8_t : 8;
+            uint8_t : 8;
+        } __attribute__((packed)) fields;
+    };
+    union reg_xdirect {
+        uint32_t raw;
+        struct {
+            int16_t coil_a : 9;
+            uint8_t : 7;
+            int16_t coil_b : 9;
+            uint8_t : 7;
+        } __attribute__((packed)) fields;
+    };
     union reg_pwmconf {
         uint32_t raw;
         struct {
@@ -213,10 +314,44 @@ class tmc5130 {
         } __attribute__((packed)) fields;
     };
 
-    /* Register access */
-    virtual int status_read(uint8_t &status) = 0;
-    virtual int register_read(const uint8_t address, uint32_t &data) = 0;
-    virtual int register_write(const uint8_t address, const uint32_t data) = 0;
+    /* Batched register access */
+    struct access {
+        uint8_t address;  //!< Register address
+        bool write;       //!< True to write data to the register, false to read the register into data
+        uint32_t data;    //!< Data to write, or data read back
+    };
+
+    /* Thread safety */
+    void lock_set(tmc5130_lock *const lock);
+
+    /* Extended position state, provided by the user so that drivers which do not need it do not carry it */
+    struct position_tracking {
+        bool tracked;      //!< Whether extended has been initialized from XACTUAL
+        uint32_t xactual;  //!< XACTUAL at the last read, to detect it wrapping around
+        int64_t extended;  //!< Position in 1/256 steps, accumulated from the XACTUAL reads
+        uint32_t modulo;   //!< Period of a modulo axis in steps, or 0 if the axis is linear
+    };
+    void position_tracking_attach(struct position_tracking *const tracking);
+
+    /* Microstep resolution switching state, provided by the user for the same reason */
+    struct microstep_switching {
+        uint32_t ramp[8];   //!< Values last written to the write only ramp registers VSTART, A_1, V_1, AMAX, VMAX, DMAX, D_1 and VSTOP
+        uint8_t valid;      //!< Bit i is set once ramp[i] has been written through the driver, switching needs all of them
+        uint8_t mres_base;  //!< Microstep resolution used when automatic switching does not select a coarser one
+        uint8_t auto_mres;  //!< Microstep resolution used above auto_speed
+        float auto_speed;   //!< Velocity in steps/s above which moves use auto_mres, or 0 to disable
+    };
+    void microstep_switching_attach(struct microstep_switching *const switching);
+
+    /* Bus trace */
+#if defined(TMC5130_TRACE)
+    void trace_attach(tmc5130_trace *const trace) {
+        m_trace = trace;
+    }
+#endif
+
+    /* Memory footprint */
+    static size_t footprint_table_get(void);
 
     /* Setup */
     struct config {
@@ -226,12 +361,82 @@ class tmc5130 {
         union reg_tpowerdown reg_tpowerdown = {.raw = 0x0000000A};  // TPOWERDOWN=10: Delay before power down in stand still
         union reg_tpwmthrs reg_tpwmthrs = {.raw = 0x000001F4};      // TPWM_THRS=500 yields a switching velocity about 35000 = ca. 30RPM
         union reg_pwmconf reg_pwmconf = {.raw = 0x000401C8};        // PWMCONF: AUTO=1, 2/1024 Fclk, Switch amplitude limit=200, Grad=1
+        union reg_tcoolthrs reg_tcoolthrs = {.raw = 0x00000000};    // TCOOLTHRS=0: coolStep and stallGuard disabled
+        union reg_thigh reg_thigh = {.raw = 0x00000000};            // THIGH=0: no switching to fullstep or constant off time chopper
+    };
+    struct setting {
+        uint8_t address;
+        uint32_t value;
     };
+
+    /* Chopper mode switching velocities */
+    struct mode_schedule {
+        float stealthchop_max;  //!< Velocity in steps/s below which stealthChop is used, or 0 to disable stealthChop
+        float coolstep_min;     //!< Velocity in steps/s above which coolStep and stallGuard are active, or 0 to disable them
+        float fullstep_min;     //!< Velocity in steps/s above which the driver switches to fullstep, or 0 to disable fullstep
+    };
+
+   protected:
+    friend class tmc5130_tuner;
+    friend class tmc5130_scurve;
+    uint32_t convert_velocity_to_tmc(const float velocity);
+    uint32_t convert_acceleration_to_tmc(const float acceleration);
+    float convert_velocity_from_tmc(const int32_t velocity);
+    uint32_t convert_velocity_to_tstep(const float velocity);
+    static uint32_t direct_pack(const int16_t coil_a, const int16_t coil_b);
+    static int16_t direct_sine(const uint16_t phase, const uint8_t amplitude);
+    static const struct setting *settings_default_get(size_t &count);
+    uint16_t ustep_per_step(void) const {
+        return 256 >> m_mres;
+    }
+    void position_track(const uint32_t xactual);
+    static int microsteps_to_mres(const uint16_t microsteps, uint8_t &mres);
+    static int position_rescale(const int32_t position, const uint8_t mres_from, const uint8_t mres_to, int32_t &result);
+    static uint32_t ramp_rescale(const uint8_t address, const uint32_t value, const uint8_t mres_from, const uint8_t mres_to);
+    static int8_t ramp_index(const uint8_t address);
+    tmc5130_lock *m_lock = NULL;  //!< Optional lock serializing accesses
+#if defined(TMC5130_TRACE)
+    tmc5130_trace *m_trace = NULL;  //!< Optional recorder of bus accesses
+#endif
+    uint8_t m_status_byte = 0x00;
+    uint32_t m_fclk = 13200000;                      //!< Frenquency at which the driver is running in Hz
+    uint8_t m_mres = 0;                              //!< Microstep resolution as written in CHOPCONF.mres, the number of microsteps per step is 256 >> m_mres
+    bool m_reference_l_latched = false;              //!<
+    bool m_reference_r_latched = false;              //!<
+    struct position_tracking *m_position = NULL;     //!< Optional extended position state
+    struct microstep_switching *m_microstep = NULL;  //!< Optional microstep resolution switching state
+};
+
+/**
+ * Driver logic, written against the register access functions of the derived class.
+ * The derived class provides status_read, register_read, register_write and optionally register_batch, which are called without virtual dispatch.
+ * This lets the compiler inline the transport into the register sequences when the derived class is a concrete transport such as tmc5130_spi_static.
+ */
+template <class derived>
+class tmc5130_base : public tmc5130_common {
+
+   public:
+    /* Batched register access */
+    int register_batch(struct access *const accesses, const size_t count);
+
+    /* Memory footprint */
+    size_t footprint_ram_get(void) const {
+        return sizeof(derived);
+    }
+
+    /* Setup */
     int setup(struct config &config);
+    int setup(const struct setting *const settings = NULL, const size_t count = 0);
     int speed_ramp_set(const float vstart, const float vstop, const float vtrans);
     int speed_limit_set(const float speed);
     int acceleration_limit_set(const float acceleration);
 
+    /* Chopper mode switching velocities */
+    int stealthchop_threshold_set(const float velocity);
+    int coolstep_threshold_set(const float velocity);
+    int high_threshold_set(const float velocity);
+    int mode_schedule_set(const struct mode_schedule &schedule);
+
     /* Movement start or stop */
     int move_to_position(const float position);
     int move_at_velocity(const float velocity);
@@ -240,6 +445,27 @@ class tmc5130 {
     /* Position */
     int position_current_get(float &position);
     int position_latched_get(float &position);
+    int position_current_set(const float position);
+
+    /* Extended position */
+    int position_extended_get(int64_t &position);
+    int position_extended_set(const int64_t position);
+    int position_modulo_set(const uint32_t period);
+    int position_modulo_get(uint32_t &position);
+
+    /* Microstep resolution */
+    int microstep_resolution_set(const uint16_t microsteps);
+    int microstep_auto_set(const float velocity, const uint16_t microsteps);
+
+    /* Velocity */
+    int velocity_current_get(float &velocity);
+
+    /* Direct coil current control */
+    int direct_mode_enable(const bool enable);
+    int direct_current_set(const int16_t coil_a, const int16_t coil_b);
+    int direct_currents_stream(const int16_t *const currents, const size_t count);
+    int direct_phase_set(const uint16_t phase, const uint8_t amplitude);
+    int direct_phases_stream(const uint16_t *const phases, const size_t count, const uint8_t amplitude);
 
     /* Target reached or not */
     int target_position_reached_is(void);
@@ -255,34 +481,90 @@ class tmc5130 {
     int reference_r_latch_enable(bool polarity);
     int reference_l_latch_get(float &position);
     int reference_r_latch_get(float &position);
-    // int reference_l_stop_enable(bool polarity);
-    // int reference_r_stop_enable(bool polarity);
+    int reference_l_stop_enable(bool enable);
+    int reference_r_stop_enable(bool enable);
+    int reference_softstop_enable(bool enable);
 
    protected:
-    uint32_t convert_velocity_to_tmc(const float velocity);
-    uint32_t convert_acceleration_to_tmc(const float acceleration);
-    uint8_t m_status_byte = 0x00;
-    uint32_t m_fclk = 13200000;          //!< Frenquency at which the driver is running in Hz
-    uint16_t m_ustep_per_step = 256;     //!< Number of microsteps per step
-    bool m_reference_l_latched = false;  //!<
-    bool m_reference_r_latched = false;  //!<
+    friend class tmc5130_tuner;
+    derived &self(void) {
+        return *static_cast<derived *>(this);
+    }
+    int position_update(uint32_t &xactual);
+    int ramp_write(const uint8_t address, const uint32_t value);
+    int microstep_auto_apply(const float velocity);
+    int microstep_switch(const uint8_t mres);
+};
+
+/**
+ * Driver with a transport selected at runtime, through virtual register access functions.
+ */
+class tmc5130 : public tmc5130_base<tmc5130> {
+
+   public:
+    virtual ~tmc5130() {}
+
+    /* Register access */
+    virtual int status_read(uint8_t &status) = 0;
+    virtual int register_read(const uint8_t address, uint32_t &data) = 0;
+    virtual int register_write(const uint8_t address, const uint32_t data) = 0;
+    virtual int register_batch(struct access *const accesses, const size_t count);
+
+    /* Memory footprint */
+    virtual size_t footprint_ram_get(void) const;
 };
 
+#if defined(ARDUINO)
+
 /**
- *
+ * Spi transport, added on top of either tmc5130 to implement its virtual functions, or tmc5130_base to be dispatched statically.
  */
-class tmc5130_spi : public tmc5130 {
+template <class base>
+class tmc5130_spi_transport : public base {
 
    public:
-    int setup(struct config &config, SPIClass &spi_library, const int spi_cs_pin, const int spi_speed = 4000000);
+    int setup(struct tmc5130_common::config &config, SPIClass &spi_library, const int spi_cs_pin, const int spi_speed = 4000000);
+    int setup(const struct tmc5130_common::setting *const settings, const size_t count, SPIClass &spi_library, const int spi_cs_pin, const int spi_speed = 4000000);
     int status_read(uint8_t &status);
     int register_read(const uint8_t address, uint32_t &data);
     int register_write(const uint8_t address, const uint32_t data);
+    int register_batch(struct tmc5130_common::access *const accesses, const size_t count);
+    size_t footprint_ram_get(void) const;
 
    protected:
+    friend class tmc5130_spi_bus;
+    int transport_setup(SPIClass &spi_library, const int spi_cs_pin, const int spi_speed);
+    int frames_transfer(struct tmc5130_common::access *const accesses, const size_t count);
     SPIClass *m_spi_library = NULL;
     uint8_t m_spi_cs_pin;
     SPISettings m_spi_settings;
 };
 
+/**
+ * Spi driver that can be used through a tmc5130 reference, for example by the helper modules.
+ */
+class tmc5130_spi : public tmc5130_spi_transport<tmc5130> {
+};
+
+/**
+ * Spi driver without virtual functions, whose register accesses can be inlined into the driver logic.
+ * @note It cannot be passed where a tmc5130 reference is expected, use tmc5130_spi for that.
+ */
+class tmc5130_spi_static : public tmc5130_spi_transport<tmc5130_base<tmc5130_spi_static> > {
+};
+
+#endif
+
+/* Template definitions */
+#include "tmc5130_impl.h"
+#if defined(ARDUINO)
+#include "tmc5130_spi_impl.h"
+#endif
+
+/* The runtime dispatched forms are compiled once, in tmc5130.cpp and tmc5130_spi.cpp */
+extern template class tmc5130_base<tmc5130>;
+#if defined(ARDUINO)
+extern template class tmc5130_spi_transport<tmc5130>;
+#endif
+
 #endif
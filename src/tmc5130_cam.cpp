@@ -0,0 +1,215 @@
+/* Self header */
+#include "tmc5130_cam.h"
+
+/**
+ *
+ * @param[in] driver The driver of the following axis.
+ * @param[in] table The position table, must remain valid as long as the cam is used.
+ * @param[in] count The number of points in the table, at least 2.
+ * @param[in] cyclic If true, the table repeats itself with a period equal to its master range.
+ *                   The position difference between both ends is accumulated at each period, so that an axis can keep advancing.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the table is not valid
+ */
+int tmc5130_cam::setup(tmc5130 &driver, const struct point *const table, const size_t count, const bool cyclic) {
+
+    /* Ensure table is valid */
+    if (table == NULL || count < 2) {
+        return -EINVAL;
+    }
+    for (size_t i = 1; i < count; i++) {
+        if (!(table[i].master > table[i - 1].master)) {
+            return -EINVAL;
+        }
+    }
+
+    /* Save parameters */
+    m_driver = &driver;
+    m_table = table;
+    m_count = count;
+    m_cyclic = cyclic;
+    m_segment = 0;
+    m_running = false;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Slaves the table to the position of another axis instead of time.
+ * @param[in] master The driver of the master axis, or NULL to index the table by time.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_cam::master_set(tmc5130 *const master) {
+    if (m_running) {
+        return -EBUSY;
+    }
+    m_master = master;
+    return 0;
+}
+
+/**
+ *
+ * @param[in] gain The position correction gain, in 1/s.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_cam::gain_set(const float gain) {
+    if (gain < 0) {
+        return -EINVAL;
+    }
+    m_gain = gain;
+    return 0;
+}
+
+/**
+ *
+ * @param[in] speed The maximum velocity commanded, in steps/s, or 0 for no limit.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_cam::speed_limit_set(const float speed) {
+    if (speed < 0) {
+        return -EINVAL;
+    }
+    m_speed_limit = speed;
+    return 0;
+}
+
+/**
+ *
+ * @param[in] time_us The current time in microseconds, such as returned by micros(), used as origin of the table when indexed by time.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_cam::start(const uint32_t time_us) {
+
+    /* Ensure setup has been done */
+    if (m_driver == NULL) {
+        return -EINVAL;
+    }
+
+    /* Start following */
+    m_time_last = time_us;
+    m_time_elapsed_us = 0;
+    m_time_periods = 0;
+    m_segment = 0;
+    m_direction = 0;
+    m_running = true;
+    return update(time_us);
+}
+
+/**
+ * Computes and writes the velocity of the axis, this should be called at a fixed rate.
+ * @param[in] time_us The current time in microseconds, such as returned by micros().
+ * @return 1 if the cam is running, 0 if it has reached the end of a non cyclic time table, or a negative error code otherwise, in particular:
+ *  -EINVAL If the cam has not been started
+ *  -EIO If there was an error communicating with one of the devices
+ */
+int tmc5130_cam::update(const uint32_t time_us) {
+
+    /* Ensure cam is running */
+    if (!m_running) {
+        return -EINVAL;
+    }
+
+    /* Retrieve master coordinate and velocity */
+    float master, master_velocity;
+    if (m_master != NULL) {
+        if (m_master->position_current_get(master) < 0 || m_master->velocity_current_get(master_velocity) < 0) {
+            return -EIO;
+        }
+    } else {
+        /* Accumulate time as an integer, the difference with the last update being immune to the wrap of time_us,
+         * and keep it within one period for cyclic tables, so the float coordinate does not lose precision */
+        m_time_elapsed_us += (uint32_t)(time_us - m_time_last);
+        m_time_last = time_us;
+        if (m_cyclic) {
+            uint64_t period_us = (uint64_t)((m_table[m_count - 1].master - m_table[0].master) * 1000000.0f);
+            if (period_us == 0) period_us = 1;
+            while (m_time_elapsed_us >= period_us) {
+                m_time_elapsed_us -= period_us;
+                m_time_periods++;
+            }
+        }
+        master = m_table[0].master + (float)m_time_elapsed_us / 1000000.0f;
+        master_velocity = 1.0f;
+    }
+
+    /* At the end of a time table, finish with a positioning move to the last point */
+    if (m_master == NULL && !m_cyclic && master >= m_table[m_count - 1].master) {
+        m_running = false;
+        if (m_driver->move_to_position(m_table[m_count - 1].position) < 0) {
+            return -EIO;
+        }
+        return 0;
+    }
+
+    /* Compute velocity from feed-forward and position error */
+    float position_target, slope, position_actual;
+    table_evaluate(master, position_target, slope);
+    if (m_master == NULL && m_cyclic) {
+        position_target += m_time_periods * (m_table[m_count - 1].position - m_table[0].position);
+    }
+    if (m_driver->position_current_get(position_actual) < 0) {
+        return -EIO;
+    }
+    float velocity = slope * master_velocity + m_gain * (position_target - position_actual);
+    if (m_speed_limit > 0) {
+        if (velocity > m_speed_limit) velocity = m_speed_limit;
+        if (velocity < -m_speed_limit) velocity = -m_speed_limit;
+    }
+
+    /* Write VMAX only, unless the direction changes */
+    int8_t direction = (velocity < 0.0f) ? -1 : 1;
+    int res;
+    if (direction != m_direction) {
+        res = m_driver->move_at_velocity(velocity);
+        m_direction = direction;
+    } else {
+        res = m_driver->speed_limit_set(fabs(velocity));
+    }
+    if (res < 0) {
+        m_direction = 0;
+        return -EIO;
+    }
+
+    /* Return running */
+    return 1;
+}
+
+/**
+ * Interpolates the table linearly.
+ * @param[in] master The master coordinate.
+ * @param[out] position The position at this coordinate.
+ * @param[out] slope The derivative of the position with respect to the master coordinate.
+ * @return 0 in case of success.
+ */
+int tmc5130_cam::table_evaluate(float master, float &position, float &slope) {
+    const float first = m_table[0].master;
+    const float last = m_table[m_count - 1].master;
+
+    /* Wrap cyclic tables, clamp the others */
+    float offset = 0.0f;
+    if (m_cyclic) {
+        float periods = floorf((master - first) / (last - first));
+        master -= periods * (last - first);
+        offset = periods * (m_table[m_count - 1].position - m_table[0].position);
+    } else if (master <= first || master >= last) {
+        position = (master <= first) ? m_table[0].position : m_table[m_count - 1].position;
+        slope = 0.0f;
+        return 0;
+    }
+
+    /* Find segment, starting from the last one used since the master usually moves little between updates */
+    while (m_segment > 0 && master < m_table[m_segment].master) {
+        m_segment--;
+    }
+    while (m_segment < m_count - 2 && master >= m_table[m_segment + 1].master) {
+        m_segment++;
+    }
+
+    /* Interpolate */
+    const struct point &p0 = m_table[m_segment];
+    const struct point &p1 = m_table[m_segment + 1];
+    slope = (p1.position - p0.position) / (p1.master - p0.master);
+    position = p0.position + slope * (master - p0.master) + offset;
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef TMC5130_CAM_H
+#define TMC5130_CAM_H
+
+/* Library header */
+#include "tmc5130.h"
+
+/**
+ * Electronic cam: makes an axis follow a position table, indexed by time or by the position of a master axis.
+ *
+ * The axis runs in velocity mode. At each update, the velocity is the slope of the table multiplied by the master velocity (feed-forward),
+ * plus a proportional correction of the difference between the table position and the measured position.
+ * Only VMAX is written, and RAMPMODE when the direction changes.
+ * @note The acceleration limit of the axis must be high enough for the ramp generator to follow the velocity changes.
+ */
+class tmc5130_cam {
+
+   public:
+    struct point {
+        float master;    //!< Time in s, or master position in steps, strictly increasing
+        float position;  //!< Axis position in steps
+    };
+    int setup(tmc5130 &driver, const struct point *const table, const size_t count, const bool cyclic = false);
+    int master_set(tmc5130 *const master);
+    int gain_set(const float gain);
+    int speed_limit_set(const float speed);
+    int start(const uint32_t time_us);
+    int update(const uint32_t time_us);
+
+   protected:
+    int table_evaluate(float master, float &position, float &slope);
+    tmc5130 *m_driver = NULL;
+    tmc5130 *m_master = NULL;
+    const struct point *m_table = NULL;
+    size_t m_count = 0;
+    size_t m_segment = 0;  //!< Index of the segment used last, where the search starts
+    bool m_cyclic = false;
+    bool m_running = false;
+    int8_t m_direction = 0;
+    float m_gain = 10.0f;         //!< Position correction gain, in 1/s
+    float m_speed_limit = 0.0f;  //!< Maximum velocity in steps/s, or 0 for no limit
+    uint32_t m_time_last;        //!< Time of the last update, in us
+    uint64_t m_time_elapsed_us;  //!< Time elapsed in the table, reduced to one period for cyclic tables, in us
+    int32_t m_time_periods;      //!< Number of periods elapsed for cyclic tables
+};
+
+#endif
@@ -0,0 +1,100 @@
+/* Self header */
+#include "tmc5130_command_queue.h"
+
+/**
+ * Adds a command to the queue, without blocking, from the single producer task or interrupt.
+ * @param[in] command
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -ENOSPC If the queue is full
+ */
+int tmc5130_command_queue::submit(const struct command &command) {
+
+    /* Ensure there is room */
+    uint8_t head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+    uint8_t head_next = (head + 1) % TMC5130_COMMAND_QUEUE_LENGTH;
+    if (head_next == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE)) {
+        return -ENOSPC;
+    }
+
+    /* Fill the slot, then publish it */
+    m_commands[head] = command;
+    __atomic_store_n(&m_head, head_next, __ATOMIC_RELEASE);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Executes pending commands on the given driver, from the single consumer task.
+ * @param[in] driver
+ * @param[in] count_max The maximum number of commands to execute.
+ * When a command fails after others were executed, their number is returned and the error is reported by the next call instead.
+ * @return The number of commands executed in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device, the failed command is dropped
+ *  -EINVAL If a command is not valid, it is dropped
+ */
+int tmc5130_command_queue::process(tmc5130 &driver, const size_t count_max) {
+    int count = 0;
+
+    /* Report the error of a command that failed at the previous call */
+    if (m_error < 0) {
+        int res = m_error;
+        m_error = 0;
+        return res;
+    }
+
+    while ((size_t)count < count_max) {
+
+        /* Retrieve next command */
+        uint8_t tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+        if (tail == __atomic_load_n(&m_head, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        struct command command = m_commands[tail];
+        __atomic_store_n(&m_tail, (uint8_t)((tail + 1) % TMC5130_COMMAND_QUEUE_LENGTH), __ATOMIC_RELEASE);
+
+        /* Execute it */
+        int res;
+        switch (command.type) {
+            case COMMAND_MOVE_TO_POSITION:
+                res = driver.move_to_position(command.value);
+                break;
+            case COMMAND_MOVE_AT_VELOCITY:
+                res = driver.move_at_velocity(command.value);
+                break;
+            case COMMAND_MOVE_STOP:
+                res = driver.move_stop();
+                break;
+            case COMMAND_SPEED_LIMIT_SET:
+                res = driver.speed_limit_set(command.value);
+                break;
+            case COMMAND_ACCELERATION_LIMIT_SET:
+                res = driver.acceleration_limit_set(command.value);
+                break;
+            default:
+                res = -EINVAL;
+                break;
+        }
+        if (res < 0) {
+            if (count > 0) {
+                m_error = res;
+                return count;
+            }
+            return res;
+        }
+        count++;
+    }
+
+    /* Return number of commands executed */
+    return count;
+}
+
+/**
+ *
+ * @return The number of commands waiting to be processed.
+ */
+size_t tmc5130_command_queue::pending_count(void) const {
+    uint8_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+    uint8_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+    return (head + TMC5130_COMMAND_QUEUE_LENGTH - tail) % TMC5130_COMMAND_QUEUE_LENGTH;
+}
@@ -0,0 +1,51 @@
+#ifndef TMC5130_COMMAND_QUEUE_H
+#define TMC5130_COMMAND_QUEUE_H
+
+/* Library header */
+#include "tmc5130.h"
+
+/* Number of slots in the queue, one of them is always kept free */
+#ifndef TMC5130_COMMAND_QUEUE_LENGTH
+#define TMC5130_COMMAND_QUEUE_LENGTH 16
+#endif
+#if TMC5130_COMMAND_QUEUE_LENGTH < 2 || TMC5130_COMMAND_QUEUE_LENGTH > 256
+#error "TMC5130_COMMAND_QUEUE_LENGTH must be between 2 and 256"
+#endif
+
+/**
+ * Lock-free single-producer single-consumer queue of motion commands.
+ * One task or interrupt submits commands without blocking, while the task owning the bus drains them into a driver.
+ * @note With several producers, each one needs its own queue.
+ */
+class tmc5130_command_queue {
+
+   public:
+    enum command_type {
+        COMMAND_MOVE_TO_POSITION,        // value is the target position in steps
+        COMMAND_MOVE_AT_VELOCITY,        // value is the velocity in steps/s
+        COMMAND_MOVE_STOP,               // value is ignored
+        COMMAND_SPEED_LIMIT_SET,         // value is the speed in steps/s
+        COMMAND_ACCELERATION_LIMIT_SET,  // value is the acceleration in steps/s²
+    };
+    struct command {
+        enum command_type type;
+        float value;
+    };
+
+    /* Producer side */
+    int submit(const struct command &command);
+
+    /* Consumer side */
+    int process(tmc5130 &driver, const size_t count_max = SIZE_MAX);
+
+    /* Either side */
+    size_t pending_count(void) const;
+
+   protected:
+    struct command m_commands[TMC5130_COMMAND_QUEUE_LENGTH];
+    uint8_t m_head = 0;  //!< Next slot to write, only modified by the producer
+    uint8_t m_tail = 0;  //!< Next slot to read, only modified by the consumer
+    int m_error = 0;     //!< Error of a command that failed after others were executed, only used by the consumer
+};
+
+#endif
@@ -0,0 +1,222 @@
+/* Self header */
+#include "tmc5130_homing.h"
+
+/**
+ *
+ * @param[in] driver The driver, which must have been setup.
+ * @param[in] side The switch to home on.
+ * @param[in] velocity_fast The velocity of the first approach and of the back off, in steps/s.
+ * @param[in] velocity_slow The velocity of the second approach, in steps/s.
+ * @param[in] backoff The distance to move away from the switch after the first approach, in steps.
+ * @param[in] distance_max The maximum distance travelled by an approach before giving up, in steps.
+ * @param[in] position_home The position given to the switch edge, in steps.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If one of the parameters is not valid
+ */
+int tmc5130_homing::setup(tmc5130 &driver, const enum side side, const float velocity_fast, const float velocity_slow, const float backoff, const float distance_max, const float position_home) {
+
+    /* Ensure parameters are valid */
+    if (!(velocity_fast > 0) || !(velocity_slow > 0) || !(backoff > 0) || !(distance_max > 0)) {
+        return -EINVAL;
+    }
+
+    /* Save parameters */
+    m_driver = &driver;
+    m_side = side;
+    m_velocity_fast = velocity_fast;
+    m_velocity_slow = velocity_slow;
+    m_backoff = backoff;
+    m_distance_max = distance_max;
+    m_position_home = position_home;
+    m_state = STATE_IDLE;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] enable If true (default), switch stops decelerate the motor using DMAX, otherwise the motor stops immediately.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_homing::softstop_enable(const bool enable) {
+    if (m_state != STATE_IDLE && m_state != STATE_DONE) {
+        return -EBUSY;
+    }
+    m_softstop = enable;
+    return 0;
+}
+
+/**
+ * Starts the fast approach.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If setup has not been done
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_homing::start(void) {
+
+    /* Ensure setup has been done */
+    if (m_driver == NULL) {
+        return -EINVAL;
+    }
+
+    /* Enable hardware stop and latch, then move towards the switch */
+    float position;
+    int res = 0;
+    res |= m_driver->reference_softstop_enable(m_softstop);
+    res |= switch_setup(true);
+    res |= m_driver->position_current_get(position);
+    res |= m_driver->speed_limit_set(m_velocity_fast);
+    res |= m_driver->move_to_position(position + ((m_side == SIDE_LEFT) ? -m_distance_max : m_distance_max));
+    if (res < 0) {
+        return abort(-EIO);
+    }
+    m_state = STATE_APPROACH_FAST;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Advances homing, this should be called regularly until it returns 0.
+ * @return 1 if homing is in progress, 0 once the axis is homed, or a negative error code otherwise, in particular:
+ *  -EINVAL If homing has not been started
+ *  -EIO If there was an error communicating with the device
+ *  -ERANGE If the switch was not found within the maximum distance, or was still active after backing off
+ */
+int tmc5130_homing::update(void) {
+    int res;
+    float position;
+
+    switch (m_state) {
+
+        case STATE_APPROACH_FAST: {
+
+            /* Wait for the hardware stop, or for the end of the search */
+            res = switch_active_get();
+            if (res < 0) return abort(-EIO);
+            if (res == 0) {
+                res = m_driver->target_position_reached_is();
+                if (res < 0) return abort(-EIO);
+                return (res == 1) ? abort(-ERANGE) : 1;
+            }
+            float velocity;
+            if (m_driver->velocity_current_get(velocity) < 0) return abort(-EIO);
+            if (velocity != 0.0f) return 1;
+
+            /* Back off without the hardware stop, so the move is not blocked while the switch is active */
+            res = 0;
+            res |= switch_setup(false);
+            res |= m_driver->position_current_get(position);
+            res |= m_driver->move_to_position(position + ((m_side == SIDE_LEFT) ? m_backoff : -m_backoff));
+            if (res < 0) return abort(-EIO);
+            m_state = STATE_BACKOFF;
+            return 1;
+        }
+
+        case STATE_BACKOFF: {
+
+            /* Wait for the back off to complete */
+            res = m_driver->target_position_reached_is();
+            if (res < 0) return abort(-EIO);
+            if (res == 0) return 1;
+            res = switch_active_get();
+            if (res < 0) return abort(-EIO);
+            if (res == 1) return abort(-ERANGE);
+
+            /* Approach slowly, latching the switch edge */
+            res = 0;
+            res |= switch_setup(true);
+            res |= m_driver->position_current_get(position);
+            res |= m_driver->speed_limit_set(m_velocity_slow);
+            res |= m_driver->move_to_position(position + ((m_side == SIDE_LEFT) ? -(m_backoff * 2) : (m_backoff * 2)));
+            if (res < 0) return abort(-EIO);
+            m_state = STATE_APPROACH_SLOW;
+            return 1;
+        }
+
+        case STATE_APPROACH_SLOW: {
+
+            /* Wait for the latch */
+            res = switch_latch_get(m_position_latched);
+            if (res < 0) return abort(-EIO);
+            if (res == 0) {
+                res = m_driver->target_position_reached_is();
+                if (res < 0) return abort(-EIO);
+                return (res == 1) ? abort(-ERANGE) : 1;
+            }
+            m_state = STATE_STOPPING;
+            return 1;
+        }
+
+        case STATE_STOPPING: {
+
+            /* Wait for the motor to be stopped by the switch */
+            float velocity;
+            if (m_driver->velocity_current_get(velocity) < 0) return abort(-EIO);
+            if (velocity != 0.0f) return 1;
+
+            /* Shift the position so that the latched edge becomes the home position */
+            res = 0;
+            res |= m_driver->position_current_get(position);
+            res |= m_driver->position_current_set(position - m_position_latched + m_position_home);
+            res |= switch_setup(false);
+            if (res < 0) return abort(-EIO);
+            m_state = STATE_DONE;
+            return 0;
+        }
+
+        case STATE_DONE: {
+            return 0;
+        }
+
+        default: {
+            return -EINVAL;
+        }
+    }
+}
+
+/**
+ * Stops the motor and homing.
+ * @param[in] error
+ * @return The given error.
+ */
+int tmc5130_homing::abort(const int error) {
+    m_driver->move_stop();
+    switch_setup(false);
+    m_state = STATE_IDLE;
+    return error;
+}
+
+/**
+ * Enables or disables the hardware stop on the homing switch, and arms its latch on the active edge.
+ * @param[in] stop
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_homing::switch_setup(const bool stop) {
+    if (m_side == SIDE_LEFT) {
+        if (m_driver->reference_l_stop_enable(stop) < 0) return -EIO;
+        if (stop && m_driver->reference_l_latch_enable(true) < 0) return -EIO;
+    } else {
+        if (m_driver->reference_r_stop_enable(stop) < 0) return -EIO;
+        if (stop && m_driver->reference_r_latch_enable(true) < 0) return -EIO;
+    }
+    return 0;
+}
+
+/**
+ *
+ * @return 1 if the homing switch is active, 0 if it is not, or a negative error code otherwise.
+ */
+int tmc5130_homing::switch_active_get(void) {
+    return (m_side == SIDE_LEFT) ? m_driver->reference_l_active_get() : m_driver->reference_r_active_get();
+}
+
+/**
+ *
+ * @param[out] position
+ * @return 1 if the latched position is available, 0 if it is not, or a negative error code otherwise.
+ */
+int tmc5130_homing::switch_latch_get(float &position) {
+    return (m_side == SIDE_LEFT) ? m_driver->reference_l_latch_get(position) : m_driver->reference_r_latch_get(position);
+}
@@ -0,0 +1,52 @@
+#ifndef TMC5130_HOMING_H
+#define TMC5130_HOMING_H
+
+/* Library header */
+#include "tmc5130.h"
+
+/**
+ * Homes an axis on one of its reference switches, using the hardware stop and position latch.
+ *
+ * The axis first approaches the switch at high velocity with the hardware stop enabled, backs off,
+ * then approaches again at low velocity. The position latched on the switch edge during the slow approach
+ * is then given the home position, so the result does not depend on the overshoot nor on the polling rate.
+ * @note The switch polarity must have been configured beforehand, for example with reference_l_polarity_set().
+ */
+class tmc5130_homing {
+
+   public:
+    enum side {
+        SIDE_LEFT,   // Home on the left switch, approached in the negative direction
+        SIDE_RIGHT,  // Home on the right switch, approached in the positive direction
+    };
+    int setup(tmc5130 &driver, const enum side side, const float velocity_fast, const float velocity_slow, const float backoff, const float distance_max, const float position_home = 0.0f);
+    int softstop_enable(const bool enable);
+    int start(void);
+    int update(void);
+
+   protected:
+    enum state {
+        STATE_IDLE,
+        STATE_APPROACH_FAST,
+        STATE_BACKOFF,
+        STATE_APPROACH_SLOW,
+        STATE_STOPPING,
+        STATE_DONE,
+    };
+    int abort(const int error);
+    int switch_setup(const bool stop);
+    int switch_active_get(void);
+    int switch_latch_get(float &position);
+    tmc5130 *m_driver = NULL;
+    enum side m_side;
+    float m_velocity_fast;
+    float m_velocity_slow;
+    float m_backoff;
+    float m_distance_max;
+    float m_position_home;
+    float m_position_latched;
+    bool m_softstop = true;
+    enum state m_state = STATE_IDLE;
+};
+
+#endif
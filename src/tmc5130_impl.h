@@ -0,0 +1,1430 @@
+/* Template definitions of tmc5130_base, included at the end of tmc5130.h */
+#ifndef TMC5130_IMPL_H
+#define TMC5130_IMPL_H
+
+/* Number of XDIRECT writes sent per batch when streaming */
+#define TMC5130_DIRECT_BATCH_LENGTH 16
+
+/**
+ *
+ * @param[in] config
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ *  -ENODEV If the device was not detected
+ */
+template <class derived>
+int tmc5130_base<derived>::setup(struct config &config) {
+    const struct setting settings[] = {
+        {reg::CHOPCONF, config.reg_chopconf.raw},
+        {reg::IHOLD_IRUN, config.reg_ihold_irun.raw},
+        {reg::TPOWERDOWN, config.reg_tpowerdown.raw},
+        {reg::GCONF, config.reg_gconf.raw},
+        {reg::TPWMTHRS, config.reg_tpwmthrs.raw},
+        {reg::PWMCONF, config.reg_pwmconf.raw},
+        {reg::TCOOLTHRS, config.reg_tcoolthrs.raw},
+        {reg::THIGH, config.reg_thigh.raw},
+    };
+    return setup(settings, sizeof(settings) / sizeof(settings[0]));
+}
+
+/**
+ * Writes the default register settings stored in flash, replacing the values of the registers given by the user.
+ * Registers given by the user that are not part of the defaults are written afterwards, in the given order.
+ * @param[in] settings The registers whose value differ from the defaults, can be NULL if count is 0.
+ * @param[in] count The number of settings.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If one of the settings is not valid
+ *  -EIO If there was an error communicating with the device
+ *  -ENODEV If the device was not detected
+ */
+template <class derived>
+int tmc5130_base<derived>::setup(const struct setting *const settings, const size_t count) {
+    tmc5130_lock_guard lock(m_lock);
+    int res;
+
+    /* Ensure settings are valid */
+    if (settings == NULL && count > 0) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (settings[i].address > 0x7F) {
+            return -EINVAL;
+        }
+    }
+
+    /* Ensure driver is dectected and has the expected version */
+    union reg_io_input_output reg_io_input_output = {0};
+    res = self().register_read(reg::IO_INPUT_OUTPUT, reg_io_input_output.raw);
+    if (res < 0) {
+        return -EIO;
+    }
+    if (reg_io_input_output.fields.version != 0x11) {
+        return -ENODEV;
+    }
+
+    /* Clear the reset and charge pump undervoltage flags */
+    union reg_gstat reg_gstat = {0};
+    reg_gstat.fields.reset = 1;
+    reg_gstat.fields.uv_cp = 1;
+    res = self().register_write(reg::GSTAT, reg_gstat.raw);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Write default registers, unless overriden */
+    size_t defaults_count;
+    const struct setting *const defaults = settings_default_get(defaults_count);
+    for (size_t i = 0; i < defaults_count; i++) {
+        uint8_t address = pgm_read_byte(&defaults[i].address);
+        uint32_t value = pgm_read_dword(&defaults[i].value);
+        for (size_t j = 0; j < count; j++) {
+            if (settings[j].address == address) {
+                value = settings[j].value;
+            }
+        }
+        if (ramp_write(address, value) < 0) {
+            return -EIO;
+        }
+        if (address == reg::CHOPCONF) {
+            union reg_chopconf reg_chopconf = {.raw = value};
+            m_mres = reg_chopconf.fields.mres > 8 ? 8 : reg_chopconf.fields.mres;
+            if (m_microstep != NULL) {
+                m_microstep->mres_base = m_mres;
+            }
+        }
+    }
+
+    /* Write remaining user registers */
+    for (size_t j = 0; j < count; j++) {
+        bool is_default = false;
+        for (size_t i = 0; i < defaults_count; i++) {
+            if (pgm_read_byte(&defaults[i].address) == settings[j].address) {
+                is_default = true;
+                break;
+            }
+        }
+        if (is_default) continue;
+        if (ramp_write(settings[j].address, settings[j].value) < 0) {
+            return -EIO;
+        }
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Performs a sequence of register accesses.
+ * This default implementation simply issues the accesses one after the other, transports that can do better should override it.
+ * @param[in,out] accesses The accesses to perform, the data of read accesses is filled in.
+ * @param[in] count The number of accesses.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::register_batch(struct access *const accesses, const size_t count) {
+    tmc5130_lock_guard lock(m_lock);
+    for (size_t i = 0; i < count; i++) {
+        int res;
+        if (accesses[i].write) {
+            res = self().register_write(accesses[i].address, accesses[i].data);
+        } else {
+            res = self().register_read(accesses[i].address, accesses[i].data);
+        }
+        if (res < 0) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
+/**
+ *
+ * @param[in] vstart
+ * @param[in] vstop
+ * @param[in] vtrans
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::speed_ramp_set(const float vstart, const float vstop, const float vtrans) {
+    tmc5130_lock_guard lock(m_lock);
+    int res;
+
+    /*  */
+    res = 0;
+    res |= ramp_write(reg::VSTART, convert_velocity_to_tmc(fabs(vstart)));
+    res |= ramp_write(reg::VSTOP, convert_velocity_to_tmc(fabs(vstop)));
+    res |= ramp_write(reg::V_1, convert_velocity_to_tmc(fabs(vtrans)));
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] speed
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::speed_limit_set(const float speed) {
+    tmc5130_lock_guard lock(m_lock);
+    int res;
+
+    /* Ensure speed is positive */
+    if (speed < 0) {
+        return -EINVAL;
+    }
+
+    /* Write register */
+    res = 0;
+    res |= ramp_write(reg::VMAX, convert_velocity_to_tmc(speed));
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] acceleration
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::acceleration_limit_set(const float acceleration) {
+    tmc5130_lock_guard lock(m_lock);
+    int res;
+
+    /* Ensure acceleration is positive */
+    if (acceleration < 0) {
+        return -EINVAL;
+    }
+
+    /* Write registers  */
+    res = 0;
+    res |= ramp_write(reg::AMAX, convert_acceleration_to_tmc(acceleration));
+    res |= ramp_write(reg::DMAX, convert_acceleration_to_tmc(acceleration));
+    res |= ramp_write(reg::A_1, convert_acceleration_to_tmc(acceleration));
+    res |= ramp_write(reg::D_1, convert_acceleration_to_tmc(acceleration));
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Sets the velocity below which stealthChop is used, when enabled in GCONF (TPWMTHRS).
+ * @param[in] velocity The velocity in steps/s.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::stealthchop_threshold_set(const float velocity) {
+    tmc5130_lock_guard lock(m_lock);
+    if (self().register_write(reg::TPWMTHRS, convert_velocity_to_tstep(velocity)) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Sets the velocity above which coolStep and stallGuard are active (TCOOLTHRS).
+ * @param[in] velocity The velocity in steps/s, or 0 to disable them.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::coolstep_threshold_set(const float velocity) {
+    tmc5130_lock_guard lock(m_lock);
+    uint32_t reg_tcoolthrs = (velocity == 0.0f) ? 0 : convert_velocity_to_tstep(velocity);
+    if (self().register_write(reg::TCOOLTHRS, reg_tcoolthrs) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Sets the velocity above which coolStep is disabled and the high velocity chopper settings of CHOPCONF (vhighfs, vhighchm) apply (THIGH).
+ * @param[in] velocity The velocity in steps/s, or 0 to never reach it.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::high_threshold_set(const float velocity) {
+    tmc5130_lock_guard lock(m_lock);
+    uint32_t reg_thigh = (velocity == 0.0f) ? 0 : convert_velocity_to_tstep(velocity);
+    if (self().register_write(reg::THIGH, reg_thigh) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Configures the velocity bands of the chopper modes, so that the driver switches between them by itself during motion.
+ * From low to high velocities: stealthChop, spreadCycle, spreadCycle with coolStep, then fullstep.
+ * @param[in] schedule
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the velocities are negative or not in increasing order
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::mode_schedule_set(const struct mode_schedule &schedule) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure bands are ordered */
+    if (schedule.stealthchop_max < 0 || schedule.coolstep_min < 0 || schedule.fullstep_min < 0) {
+        return -EINVAL;
+    }
+    if (schedule.coolstep_min > 0 && schedule.coolstep_min < schedule.stealthchop_max) {
+        return -EINVAL;
+    }
+    if (schedule.fullstep_min > 0 && (schedule.fullstep_min <= schedule.stealthchop_max || schedule.fullstep_min <= schedule.coolstep_min)) {
+        return -EINVAL;
+    }
+
+    /* Write thresholds */
+    int res = 0;
+    res |= self().register_write(reg::TPWMTHRS, (schedule.stealthchop_max > 0) ? convert_velocity_to_tstep(schedule.stealthchop_max) : 0);
+    res |= self().register_write(reg::TCOOLTHRS, (schedule.coolstep_min > 0) ? convert_velocity_to_tstep(schedule.coolstep_min) : 0);
+    res |= self().register_write(reg::THIGH, (schedule.fullstep_min > 0) ? convert_velocity_to_tstep(schedule.fullstep_min) : 0);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Enable stealthChop if it has a band */
+    union reg_gconf reg_gconf;
+    if (self().register_read(reg::GCONF, reg_gconf.raw) < 0) {
+        return -EIO;
+    }
+    reg_gconf.fields.en_pwm_mode = (schedule.stealthchop_max > 0) ? 1 : 0;
+    if (self().register_write(reg::GCONF, reg_gconf.raw) < 0) {
+        return -EIO;
+    }
+
+    /* Enable fullstep above THIGH if it has a band */
+    union reg_chopconf reg_chopconf;
+    if (self().register_read(reg::CHOPCONF, reg_chopconf.raw) < 0) {
+        return -EIO;
+    }
+    reg_chopconf.fields.vhighfs = (schedule.fullstep_min > 0) ? 1 : 0;
+    reg_chopconf.fields.vhighchm = (schedule.fullstep_min > 0) ? 1 : 0;
+    if (self().register_write(reg::CHOPCONF, reg_chopconf.raw) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] position
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::move_to_position(const float position) {
+    tmc5130_lock_guard lock(m_lock);
+    int res;
+
+    /* Select microstep resolution for the speed limit */
+    if (m_microstep != NULL && microstep_auto_apply(convert_velocity_from_tmc(m_microstep->ramp[ramp_index(reg::VMAX)])) < 0) {
+        return -EIO;
+    }
+
+    /* Set XTARGET
+     * This is done before switching mode, so the motor does not head for the previous target in between */
+    int32_t reg_xtarget = roundf(position * ustep_per_step());
+    res = self().register_write(reg::XTARGET, (uint32_t)reg_xtarget);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Set RAMPMODE to Positioning mode */
+    res = self().register_write(reg::RAMPMODE, 0x00);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] velocity
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::move_at_velocity(const float velocity) {
+    tmc5130_lock_guard lock(m_lock);
+    int res;
+
+    /* Select microstep resolution for this velocity */
+    if (microstep_auto_apply(fabs(velocity)) < 0) {
+        return -EIO;
+    }
+
+    /* */
+    res = 0;
+    res |= ramp_write(reg::VMAX, convert_velocity_to_tmc(fabs(velocity)));
+    res |= self().register_write(reg::RAMPMODE, velocity < 0.0f ? 2 : 1);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::move_stop(void) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* For a stop in positioning mode, set VSTART=0 and VMAX=0 */
+    int res = 0;
+    res |= ramp_write(reg::VSTART, 0);
+    res |= ramp_write(reg::VMAX, 0);
+    if (res != 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[out] position
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_current_get(float &position) {
+    tmc5130_lock_guard lock(m_lock);
+    uint32_t reg_xactual;
+    if (position_update(reg_xactual) < 0) {
+        return -EIO;
+    }
+    position = (int32_t)reg_xactual;
+    position /= ustep_per_step();
+    return 0;
+}
+
+/**
+ *
+ * @param[out] position
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_latched_get(float &position) {
+    tmc5130_lock_guard lock(m_lock);
+    int32_t position_ustep;
+    uint32_t reg_xlatch;
+    if (self().register_read(reg::XLATCH, reg_xlatch) < 0) {
+        return -EIO;
+    }
+    position = (int32_t)reg_xlatch;
+    position /= ustep_per_step();
+    return 0;
+}
+
+/**
+ * Redefines the current position, which should be done while the motor is stopped.
+ * The target is set to the same position, and the ramp generator is left in positioning mode so the motor stays still.
+ * @param[in] position
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_current_set(const float position) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Write XACTUAL and XTARGET in hold mode, then go back to positioning mode */
+    int32_t reg_xactual = roundf(position * ustep_per_step());
+    int res = 0;
+    res |= self().register_write(reg::RAMPMODE, 3);
+    res |= self().register_write(reg::XACTUAL, (uint32_t)reg_xactual);
+    res |= self().register_write(reg::XTARGET, (uint32_t)reg_xactual);
+    res |= self().register_write(reg::RAMPMODE, 0);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Restart the extended position from there */
+    if (m_position != NULL) {
+        m_position->tracked = false;
+        position_track((uint32_t)reg_xactual);
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Reads the current position without the range limit of XACTUAL and the precision limit of floats.
+ * Wrap arounds of XACTUAL are accumulated every time it is read, so this function or position_current_get must be called at least once every 2^31 microsteps.
+ * @param[out] position The position in 1/256 steps whatever the microstep resolution, position >> 8 being the number of full steps.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If no extended position state has been attached with position_tracking_attach
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_extended_get(int64_t &position) {
+    tmc5130_lock_guard lock(m_lock);
+    if (m_position == NULL) {
+        return -EINVAL;
+    }
+    uint32_t reg_xactual;
+    if (position_update(reg_xactual) < 0) {
+        return -EIO;
+    }
+    position = m_position->extended;
+    return 0;
+}
+
+/**
+ * Redefines the current position, which should be done while the motor is stopped.
+ * Only the lower 32 bits of the position in microsteps are written to XACTUAL, or its remainder by the period on a modulo axis.
+ * @param[in] position The position in 1/256 steps, the part finer than the microstep resolution is dropped.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If no extended position state has been attached with position_tracking_attach
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_extended_set(const int64_t position) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure extended position is enabled */
+    if (m_position == NULL) {
+        return -EINVAL;
+    }
+
+    /* Compute the position in microsteps, and what to write in the driver */
+    int64_t position_ustep = position / (1 << m_mres) - ((position % (1 << m_mres)) < 0 ? 1 : 0);
+    int32_t reg_xactual = (int32_t)position_ustep;
+    if (m_position->modulo != 0) {
+        int64_t period_ustep = (int64_t)m_position->modulo * ustep_per_step();
+        reg_xactual = (int32_t)(position_ustep % period_ustep);
+    }
+
+    /* Write XACTUAL and XTARGET in hold mode, then go back to positioning mode */
+    int res = 0;
+    res |= self().register_write(reg::RAMPMODE, 3);
+    res |= self().register_write(reg::XACTUAL, (uint32_t)reg_xactual);
+    res |= self().register_write(reg::XTARGET, (uint32_t)reg_xactual);
+    res |= self().register_write(reg::RAMPMODE, 0);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Restart the extended position from there */
+    m_position->tracked = true;
+    m_position->xactual = (uint32_t)reg_xactual;
+    m_position->extended = position_ustep * (1 << m_mres);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Turns the axis into a modulo axis, such as a turntable, whose XACTUAL and XTARGET are kept close to 0 so it can turn forever in velocity mode.
+ * When XACTUAL is beyond TMC5130_POSITION_REBASE_THRESHOLD microsteps while the motor stands still, a whole number of periods is removed from both XACTUAL and XTARGET.
+ * @note The rebase reads XACTUAL and then writes it back shifted, so it is only done at standstill, where no microstep can be lost in between.
+ * While the motor keeps turning, XACTUAL is left to grow and wrap, position_modulo_get stays exact as it works on the extended position.
+ * @param[in] period The number of steps in one period of the axis, or 0 to make it a linear axis again.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If no extended position state has been attached, or if the period is larger than TMC5130_POSITION_REBASE_THRESHOLD / 256 steps
+ */
+template <class derived>
+int tmc5130_base<derived>::position_modulo_set(const uint32_t period) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure a rebase always brings XACTUAL below the threshold, even at 256 microsteps */
+    if (m_position == NULL || period > (uint32_t)(TMC5130_POSITION_REBASE_THRESHOLD / 256)) {
+        return -EINVAL;
+    }
+
+    /* Save period */
+    m_position->modulo = period;
+    return 0;
+}
+
+/**
+ * Reads the current position within the period of a modulo axis.
+ * @param[out] position The position in 1/256 steps, from 0 to 256 times the period excluded.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the axis is not a modulo axis
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_modulo_get(uint32_t &position) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure axis is a modulo axis */
+    if (m_position == NULL || m_position->modulo == 0) {
+        return -EINVAL;
+    }
+
+    /* Update the extended position, and reduce it */
+    uint32_t reg_xactual;
+    if (position_update(reg_xactual) < 0) {
+        return -EIO;
+    }
+    int64_t period = (int64_t)m_position->modulo * 256;
+    int64_t remainder = m_position->extended % period;
+    position = (uint32_t)(remainder < 0 ? remainder + period : remainder);
+    return 0;
+}
+
+/**
+ * Reads XACTUAL, accumulates it into the extended position, and rebases it if this is a modulo axis that went too far.
+ * @param[out] xactual The value of XACTUAL, after the rebase if there was one.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::position_update(uint32_t &xactual) {
+
+    /* Read and accumulate position */
+    if (self().register_read(reg::XACTUAL, xactual) < 0) {
+        return -EIO;
+    }
+    position_track(xactual);
+
+    /* Leave it if it is close enough to 0, comparing the magnitude as unsigned since it may be 2^31 */
+    if (m_position == NULL || m_position->modulo == 0) {
+        return 0;
+    }
+    uint32_t magnitude = ((int32_t)xactual < 0) ? (0u - xactual) : xactual;
+    if (magnitude < (uint32_t)TMC5130_POSITION_REBASE_THRESHOLD) {
+        return 0;
+    }
+
+    /* Only rebase at standstill, as microsteps done between reading and writing XACTUAL would be lost */
+    struct access checks[] = {
+        {reg::RAMPMODE, false, 0},
+        {reg::VACTUAL, false, 0},
+    };
+    if (self().register_batch(checks, 2) < 0) {
+        return -EIO;
+    }
+    if ((checks[1].data & 0x00FFFFFF) != 0) {
+        return 0;
+    }
+
+    /* Hold the ramp generator, so the motor cannot start, then read velocity, target, and position again */
+    struct access reads[] = {
+        {reg::RAMPMODE, true, 3},
+        {reg::VACTUAL, false, 0},
+        {reg::XTARGET, false, 0},
+        {reg::XACTUAL, false, 0},
+    };
+    if (self().register_batch(reads, 4) < 0) {
+        self().register_write(reg::RAMPMODE, checks[0].data & 0x03);
+        return -EIO;
+    }
+    xactual = reads[3].data;
+    position_track(xactual);
+    if ((reads[1].data & 0x00FFFFFF) != 0) {
+        if (self().register_write(reg::RAMPMODE, checks[0].data & 0x03) < 0) {
+            return -EIO;
+        }
+        return 0;
+    }
+
+    /* Shift position and target by whole periods, then release the ramp generator */
+    int32_t period = (int32_t)m_position->modulo * ustep_per_step();
+    uint32_t offset = (uint32_t)(((int32_t)xactual / period) * period);
+    struct access writes[] = {
+        {reg::XACTUAL, true, xactual - offset},
+        {reg::XTARGET, true, reads[2].data - offset},
+        {reg::RAMPMODE, true, checks[0].data & 0x03},
+    };
+    if (self().register_batch(writes, 3) < 0) {
+        return -EIO;
+    }
+    xactual -= offset;
+    m_position->xactual = xactual;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Changes the microstep resolution, and rescales the position, target and ramp registers so the motion stays the same in steps.
+ * The resolution can only be changed while the motor stands still, because the velocity of the ramp generator cannot be rescaled.
+ * @note The ramp registers are write only, so they are rescaled from the values last written through this class, writing them with register_write directly defeats this.
+ * @param[in] microsteps The number of microsteps per step, a power of two from 1 to 256.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If no state has been attached with microstep_switching_attach, if the number of microsteps is not valid,
+ *  or if one of the ramp registers has not been written since the state was attached
+ *  -EBUSY If the motor is moving
+ *  -ERANGE If the position would not fit in XACTUAL at the new resolution
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::microstep_resolution_set(const uint16_t microsteps) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Convert microsteps into mres */
+    uint8_t mres;
+    if (m_microstep == NULL || microsteps_to_mres(microsteps, mres) < 0) {
+        return -EINVAL;
+    }
+
+    /* Switch */
+    int res = microstep_switch(mres);
+    if (res < 0) {
+        return res;
+    }
+    m_microstep->mres_base = mres;
+    return 0;
+}
+
+/**
+ * Makes the moves started from standstill faster than a threshold use a coarser microstep resolution, and the slower ones go back to the normal resolution.
+ * The normal resolution is the one from setup or microstep_resolution_set.
+ * Moves started while the motor is moving, or before each ramp register has been written since the state was attached, keep the current resolution.
+ * @param[in] velocity The velocity in steps/s above which the coarser resolution is used, or 0 to disable automatic switching.
+ * @param[in] microsteps The number of microsteps per step used above the threshold, a power of two from 1 to 256.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If no state has been attached with microstep_switching_attach, or if the number of microsteps is not valid
+ */
+template <class derived>
+int tmc5130_base<derived>::microstep_auto_set(const float velocity, const uint16_t microsteps) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Convert microsteps into mres */
+    uint8_t mres;
+    if (m_microstep == NULL || microsteps_to_mres(microsteps, mres) < 0) {
+        return -EINVAL;
+    }
+
+    /* Save settings */
+    m_microstep->auto_speed = fabs(velocity);
+    m_microstep->auto_mres = mres;
+    return 0;
+}
+
+/**
+ * Writes a ramp register, and remembers its value as they cannot be read back, if microstep switching is enabled.
+ * @param[in] address
+ * @param[in] value
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::ramp_write(const uint8_t address, const uint32_t value) {
+    if (self().register_write(address, value) < 0) {
+        return -EIO;
+    }
+    int8_t index = ramp_index(address);
+    if (m_microstep != NULL && index >= 0) {
+        m_microstep->ramp[index] = value;
+        m_microstep->valid |= (uint8_t)(1 << index);
+    }
+    return 0;
+}
+
+/**
+ * Selects the microstep resolution for a move at the given velocity, when automatic switching is enabled.
+ * @param[in] velocity The velocity of the move in steps/s.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::microstep_auto_apply(const float velocity) {
+
+    /* Ensure automatic switching is enabled and needed */
+    if (m_microstep == NULL || m_microstep->auto_speed <= 0) {
+        return 0;
+    }
+    uint8_t mres = (velocity > m_microstep->auto_speed) ? m_microstep->auto_mres : m_microstep->mres_base;
+    if (mres == m_mres) {
+        return 0;
+    }
+
+    /* Switch, unless the motor is moving, the position does not fit, or the ramp registers are not all known yet, in which case the current resolution is kept */
+    int res = microstep_switch(mres);
+    if (res < 0 && res != -EBUSY && res != -ERANGE && res != -EINVAL) {
+        return res;
+    }
+    return 0;
+}
+
+/**
+ * Changes the microstep resolution in CHOPCONF, and rescales XACTUAL, XTARGET and the ramp registers accordingly.
+ * @note A microstep switching state must be attached, it holds the ramp registers to rescale.
+ * @param[in] mres The new value of CHOPCONF.mres.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If one of the ramp registers has not been written since the state was attached, so it cannot be rescaled
+ *  -EBUSY If the motor is moving
+ *  -ERANGE If the position would not fit in XACTUAL at the new resolution
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::microstep_switch(const uint8_t mres) {
+
+    /* Nothing to do if the resolution does not change */
+    if (mres == m_mres) {
+        return 0;
+    }
+
+    /* Ensure every ramp register is known, rewriting one as 0 could be forbidden in positioning mode */
+    if (m_microstep->valid != 0xFF) {
+        return -EINVAL;
+    }
+
+    /* Read mode, chopper configuration, velocity, target and position */
+    struct access reads[] = {
+        {reg::RAMPMODE, false, 0},
+        {reg::CHOPCONF, false, 0},
+        {reg::VACTUAL, false, 0},
+        {reg::XTARGET, false, 0},
+        {reg::XACTUAL, false, 0},
+    };
+    if (self().register_batch(reads, 5) < 0) {
+        return -EIO;
+    }
+    position_track(reads[4].data);
+
+    /* Ensure motor stands still */
+    if ((reads[2].data & 0x00FFFFFF) != 0) {
+        return -EBUSY;
+    }
+
+    /* Rescale position and target */
+    int32_t xactual, xtarget;
+    if (position_rescale((int32_t)reads[4].data, m_mres, mres, xactual) < 0 || position_rescale((int32_t)reads[3].data, m_mres, mres, xtarget) < 0) {
+        return -ERANGE;
+    }
+
+    /* Write everything in hold mode, so the new position does not start a move, with the ramp registers rescaled in the order of the cache */
+    union reg_chopconf reg_chopconf = {.raw = reads[1].data};
+    reg_chopconf.fields.mres = mres;
+    struct access writes[] = {
+        {reg::RAMPMODE, true, 3},
+        {reg::CHOPCONF, true, reg_chopconf.raw},
+        {reg::XACTUAL, true, (uint32_t)xactual},
+        {reg::XTARGET, true, (uint32_t)xtarget},
+        {reg::VSTART, true, 0},
+        {reg::A_1, true, 0},
+        {reg::V_1, true, 0},
+        {reg::AMAX, true, 0},
+        {reg::VMAX, true, 0},
+        {reg::DMAX, true, 0},
+        {reg::D_1, true, 0},
+        {reg::VSTOP, true, 0},
+        {reg::RAMPMODE, true, reads[0].data & 0x03},
+    };
+    const size_t count = sizeof(writes) / sizeof(writes[0]);
+    for (size_t i = 0; i < 8; i++) {
+        writes[4 + i].data = ramp_rescale(writes[4 + i].address, m_microstep->ramp[i], m_mres, mres);
+    }
+    if (self().register_batch(writes, count) < 0) {
+        return -EIO;
+    }
+
+    /* Update cached values, the extended position is kept as is since it does not depend on the resolution */
+    for (size_t i = 0; i < 8; i++) {
+        m_microstep->ramp[i] = writes[4 + i].data;
+    }
+    if (m_position != NULL) {
+        m_position->xactual = (uint32_t)xactual;
+    }
+    m_mres = mres;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[out] velocity The velocity from the ramp generator, in steps/s.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::velocity_current_get(float &velocity) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read VACTUAL and sign extend it from 24 bits */
+    uint32_t reg_vactual;
+    if (self().register_read(reg::VACTUAL, reg_vactual) < 0) {
+        return -EIO;
+    }
+    int32_t vactual = (int32_t)(reg_vactual << 8) >> 8;
+    velocity = convert_velocity_from_tmc(vactual);
+    return 0;
+}
+
+/**
+ * Enables or disables direct mode, in which coil currents are written through XDIRECT instead of being generated by the ramp generator.
+ * @param[in] enable
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::direct_mode_enable(const bool enable) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 16 direct_mode of GCONF */
+    union reg_gconf reg_gconf;
+    if (self().register_read(reg::GCONF, reg_gconf.raw) < 0) {
+        return -EIO;
+    }
+    reg_gconf.fields.direct_mode = enable ? 1 : 0;
+    if (self().register_write(reg::GCONF, reg_gconf.raw) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] coil_a Current of coil A, from -255 to 255.
+ * @param[in] coil_b Current of coil B, from -255 to 255.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If a current is out of range
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::direct_current_set(const int16_t coil_a, const int16_t coil_b) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure currents are within range */
+    if (coil_a < -255 || coil_a > 255 || coil_b < -255 || coil_b > 255) {
+        return -EINVAL;
+    }
+
+    /* Write XDIRECT */
+    if (self().register_write(reg::XDIRECT, direct_pack(coil_a, coil_b)) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Writes a sequence of coil currents as fast as the transport allows, using batched writes.
+ * @param[in] currents Pairs of coil A and coil B currents, each from -255 to 255.
+ * @param[in] count The number of pairs.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If a current is out of range
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::direct_currents_stream(const int16_t *const currents, const size_t count) {
+    tmc5130_lock_guard lock(m_lock);
+    struct access accesses[TMC5130_DIRECT_BATCH_LENGTH];
+
+    for (size_t i = 0; i < count;) {
+
+        /* Fill a batch */
+        size_t n = 0;
+        for (; n < TMC5130_DIRECT_BATCH_LENGTH && i < count; n++, i++) {
+            int16_t coil_a = currents[2 * i];
+            int16_t coil_b = currents[2 * i + 1];
+            if (coil_a < -255 || coil_a > 255 || coil_b < -255 || coil_b > 255) {
+                return -EINVAL;
+            }
+            accesses[n].address = reg::XDIRECT;
+            accesses[n].write = true;
+            accesses[n].data = direct_pack(coil_a, coil_b);
+        }
+
+        /* Send it */
+        if (self().register_batch(accesses, n) < 0) {
+            return -EIO;
+        }
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Sets the coil currents to a point of a sine and cosine wave.
+ * @param[in] phase The electrical angle, 1024 for a full period (4 full steps), only the 10 lower bits are used.
+ * @param[in] amplitude The peak current, from 0 to 255.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::direct_phase_set(const uint16_t phase, const uint8_t amplitude) {
+    return direct_current_set(direct_sine(phase, amplitude), direct_sine(phase + 256, amplitude));
+}
+
+/**
+ * Writes a sequence of electrical angles as fast as the transport allows, using batched writes.
+ * @param[in] phases The electrical angles, 1024 for a full period (4 full steps).
+ * @param[in] count The number of angles.
+ * @param[in] amplitude The peak current, from 0 to 255.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::direct_phases_stream(const uint16_t *const phases, const size_t count, const uint8_t amplitude) {
+    tmc5130_lock_guard lock(m_lock);
+    struct access accesses[TMC5130_DIRECT_BATCH_LENGTH];
+
+    for (size_t i = 0; i < count;) {
+
+        /* Fill a batch */
+        size_t n = 0;
+        for (; n < TMC5130_DIRECT_BATCH_LENGTH && i < count; n++, i++) {
+            accesses[n].address = reg::XDIRECT;
+            accesses[n].write = true;
+            accesses[n].data = direct_pack(direct_sine(phases[i], amplitude), direct_sine(phases[i] + 256, amplitude));
+        }
+
+        /* Send it */
+        if (self().register_batch(accesses, n) < 0) {
+            return -EIO;
+        }
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @return 1 if the target position has been reached, 0 if it has not, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::target_position_reached_is(void) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read bit 9 position_reached of RAMP_STAT
+     * 1: Signals, that the target position is reached. This flag becomes set while XACTUAL and XTARGET match */
+    uint32_t reg_ramp_status;
+    if (self().register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
+        return -EIO;
+    }
+
+    /* Remember flags that are cleared upon reading */
+    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
+    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
+
+    /* Return wether the target is reached */
+    if (reg_ramp_status & (1 << 9)) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ *
+ * @return 1 if the target velocity has been reached, 0 if it has not, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::target_velocity_reached_is(void) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read bit 8 velocity_reached of RAMP_STAT
+     * 1: Signals, that the target velocity is reached. This flag becomes set while VACTUAL and VMAX match. */
+    uint32_t reg_ramp_status;
+    if (self().register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
+        return -EIO;
+    }
+
+    /* Remember flags that are cleared upon reading */
+    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
+    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
+
+    /* Return wether the target is reached */
+    if (reg_ramp_status & (1 << 8)) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ *
+ * @param[in] swap
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_swap(bool swap) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 4 of SW_MODE
+     * 1: Swap the left and the right reference switch input REFL and REFR */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (swap) {
+        reg_sw_mode |= (1 << 4);
+    } else {
+        reg_sw_mode &= ~(1 << 4);
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] active_high
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_l_polarity_set(bool active_high) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 2 of SW_MODE
+     * Sets the active polarity of the left reference switch input
+     * 0=non-inverted, high active: a high level on REFL stops the motor
+     * 1=inverted, low active: a low level on REFL stops the motor */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (active_high) {
+        reg_sw_mode &= ~(1 << 2);
+    } else {
+        reg_sw_mode |= (1 << 2);
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] active_high
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_r_polarity_set(bool active_high) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 3 of SW_MODE
+     * Sets the active polarity of the right reference switch input
+     * 0=non-inverted, high active: a high level on REFR stops the motor
+     * 1=inverted, low active: a low level on REFR stops the motor */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (active_high) {
+        reg_sw_mode &= ~(1 << 3);
+    } else {
+        reg_sw_mode |= (1 << 3);
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_l_active_get(void) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read bit 0 status_stop_l of RAMP_STAT
+     * Reference switch left status (1=active) */
+    uint32_t reg_ramp_status;
+    if (self().register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
+        return -EIO;
+    }
+
+    /* Remember flags that are cleared upon reading */
+    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
+    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
+
+    /* Return wether the switch is active */
+    return (reg_ramp_status & (1 << 0)) ? 1 : 0;
+}
+
+/**
+ *
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_r_active_get(void) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read bit 1 status_stop_r of RAMP_STAT
+     * Reference switch right status (1=active) */
+    uint32_t reg_ramp_status;
+    if (self().register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
+        return -EIO;
+    }
+
+    /* Remember flags that are cleared upon reading */
+    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
+    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
+
+    /* Return wether the switch is active */
+    return (reg_ramp_status & (1 << 1)) ? 1 : 0;
+}
+
+/**
+ *
+ * @param[in] polarity If true the position will be latched when the reference switch goes active, and conversely.
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_l_latch_enable(bool polarity) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Reset flag */
+    m_reference_l_latched = false;
+
+    /* Set bit 6 and 5 of SW_MODE */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (polarity) {
+        reg_sw_mode &= ~(1 << 6);  // latch_l_inactive = 0
+        reg_sw_mode |= (1 << 5);   // latch_l_active = 1
+    } else {
+        reg_sw_mode |= (1 << 6);   // latch_l_inactive = 1
+        reg_sw_mode &= ~(1 << 5);  // latch_l_active = 0
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] polarity If true the position will be latched when the reference switch goes active, and conversely.
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_r_latch_enable(bool polarity) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Reset flag */
+    m_reference_r_latched = false;
+
+    /* Set bit 8 and 7 of SW_MODE */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (polarity) {
+        reg_sw_mode &= ~(1 << 8);  // latch_r_inactive = 0
+        reg_sw_mode |= (1 << 7);   // latch_r_active = 1
+    } else {
+        reg_sw_mode |= (1 << 8);   // latch_r_inactive = 1
+        reg_sw_mode &= ~(1 << 7);  // latch_r_active = 0
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[out] position
+ * @return 1 if the latched position is available, 0 if it is not, or a negative error code otherwise.
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_l_latch_get(float &position) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read bit 2 status_latch_l of RAMP_STAT
+     * 1: Latch left ready */
+    uint32_t reg_ramp_status;
+    if (self().register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
+        return -EIO;
+    }
+
+    /* Remember flags that are cleared upon reading */
+    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
+    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
+
+    /* If latched position is available */
+    if (m_reference_l_latched) {
+
+        /* Retrieve position */
+        uint32_t reg_xlatch;
+        if (self().register_read(reg::XLATCH, reg_xlatch) < 0) {
+            return -EIO;
+        }
+        position = (int32_t)reg_xlatch;
+        position /= ustep_per_step();
+
+        /* Reset flag */
+        m_reference_l_latched = false;
+
+        /* Return success */
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ *
+ * @param[out] position
+ * @return 1 if the latched position is available, 0 if it is not, or a negative error code otherwise.
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_r_latch_get(float &position) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Read bit 3 status_latch_r of RAMP_STAT
+     * 1: Latch right ready */
+    uint32_t reg_ramp_status;
+    if (self().register_read(reg::RAMP_STAT, reg_ramp_status) < 0) {
+        return -EIO;
+    }
+
+    /* Remember flags that are cleared upon reading */
+    m_reference_l_latched = (reg_ramp_status & (1 << 2)) ? true : m_reference_l_latched;
+    m_reference_r_latched = (reg_ramp_status & (1 << 3)) ? true : m_reference_r_latched;
+
+    /* If latched position is available */
+    if (m_reference_r_latched) {
+
+        /* Retrieve position */
+        uint32_t reg_xlatch;
+        if (self().register_read(reg::XLATCH, reg_xlatch) < 0) {
+            return -EIO;
+        }
+        position = (int32_t)reg_xlatch;
+        position /= ustep_per_step();
+
+        /* Reset flag */
+        m_reference_r_latched = false;
+
+        /* Return success */
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/**
+ *
+ * @param[in] enable If true, the motor is stopped when the left reference switch becomes active while moving in the negative direction.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_l_stop_enable(bool enable) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 0 stop_l_enable of SW_MODE */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (enable) {
+        reg_sw_mode |= (1 << 0);
+    } else {
+        reg_sw_mode &= ~(1 << 0);
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] enable If true, the motor is stopped when the right reference switch becomes active while moving in the positive direction.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_r_stop_enable(bool enable) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 1 stop_r_enable of SW_MODE */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (enable) {
+        reg_sw_mode |= (1 << 1);
+    } else {
+        reg_sw_mode &= ~(1 << 1);
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] enable If true, a switch stop decelerates the motor using DMAX instead of stopping it immediately.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+template <class derived>
+int tmc5130_base<derived>::reference_softstop_enable(bool enable) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Set bit 11 en_softstop of SW_MODE */
+    uint32_t reg_sw_mode;
+    if (self().register_read(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+    if (enable) {
+        reg_sw_mode |= (1 << 11);
+    } else {
+        reg_sw_mode &= ~(1 << 11);
+    }
+    if (self().register_write(reg::SW_MODE, reg_sw_mode) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+#endif
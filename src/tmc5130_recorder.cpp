@@ -0,0 +1,223 @@
+/* Self header */
+#include "tmc5130_recorder.h"
+
+/* Frame markers */
+#define TMC5130_RECORDER_SYNC_DELTA 0xA5
+#define TMC5130_RECORDER_SYNC_KEY 0xA6
+
+/* Largest frame: sync, length, register count, addresses, time and values as 5-byte varints, checksum */
+#define TMC5130_RECORDER_FRAME_MAX (2 + 1 + TMC5130_RECORDER_REGISTERS_MAX + 5 + 5 * TMC5130_RECORDER_REGISTERS_MAX + 1)
+
+/**
+ * Appends a zigzag encoded varint.
+ * @param[out] data
+ * @param[in] value
+ * @return The number of bytes written.
+ */
+static size_t varint_encode(uint8_t *const data, const int32_t value) {
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t size = 0;
+    while (zigzag >= 0x80) {
+        data[size++] = (zigzag & 0x7F) | 0x80;
+        zigzag >>= 7;
+    }
+    data[size++] = zigzag;
+    return size;
+}
+
+/**
+ *
+ * @param[in] driver The driver to sample.
+ * @param[in] addresses The registers to sample.
+ * @param[in] count The number of registers.
+ * @param[in] period_us The sampling period in microseconds.
+ * @param[in] buffer The ring buffer in which frames are stored, must remain valid as long as the recorder is used.
+ * @param[in] buffer_size The size of the ring buffer, should hold at least a few frames.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If one of the parameters is not valid
+ */
+int tmc5130_recorder::setup(tmc5130 &driver, const uint8_t *const addresses, const size_t count, const uint32_t period_us, uint8_t *const buffer, const size_t buffer_size) {
+
+    /* Ensure parameters are valid */
+    if (addresses == NULL || count == 0 || count > TMC5130_RECORDER_REGISTERS_MAX) {
+        return -EINVAL;
+    }
+    if (buffer == NULL || buffer_size <= TMC5130_RECORDER_FRAME_MAX) {
+        return -EINVAL;
+    }
+
+    /* Save parameters */
+    m_driver = &driver;
+    memcpy(m_addresses, addresses, count);
+    m_count = count;
+    m_period_us = period_us;
+    m_buffer = buffer;
+    m_buffer_size = buffer_size;
+
+    /* Reset state, the first frame will be a key frame */
+    m_head = 0;
+    m_tail = 0;
+    m_dropped = 0;
+    m_keyframe_countdown = 0;
+    m_time_next = 0;
+    m_time_last = 0;
+    m_started = false;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Samples the registers if the period has elapsed, this should be called at least as often as the sampling period.
+ * @param[in] time_us The current time in microseconds, such as returned by micros().
+ * @return 1 if a sample was taken, 0 if it was not yet time to, or a negative error code otherwise, in particular:
+ *  -EINVAL If setup has not been done
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_recorder::sample(const uint32_t time_us) {
+
+    /* Ensure setup has been done */
+    if (m_driver == NULL) {
+        return -EINVAL;
+    }
+
+    /* Wait for the sampling time, catching up if we are late by more than a period */
+    if (m_started && (int32_t)(time_us - m_time_next) < 0) {
+        return 0;
+    }
+    m_time_next += m_period_us;
+    if (!m_started || (int32_t)(time_us - m_time_next) >= 0) {
+        m_time_next = time_us + m_period_us;
+    }
+
+    /* Read all registers at once */
+    struct tmc5130::access accesses[TMC5130_RECORDER_REGISTERS_MAX];
+    for (uint8_t i = 0; i < m_count; i++) {
+        accesses[i].address = m_addresses[i];
+        accesses[i].write = false;
+        accesses[i].data = 0;
+    }
+    if (m_driver->register_batch(accesses, m_count) < 0) {
+        return -EIO;
+    }
+
+    /* Encode frame */
+    uint8_t frame[TMC5130_RECORDER_FRAME_MAX];
+    size_t size = 2;
+    bool keyframe = (m_keyframe_countdown == 0);
+    if (keyframe) {
+        frame[size++] = m_count;
+        memcpy(&frame[size], m_addresses, m_count);
+        size += m_count;
+        size += varint_encode(&frame[size], (int32_t)time_us);
+    } else {
+        size += varint_encode(&frame[size], (int32_t)(time_us - m_time_last));
+    }
+    for (uint8_t i = 0; i < m_count; i++) {
+        uint32_t reference = keyframe ? 0 : m_values[i];
+        size += varint_encode(&frame[size], (int32_t)(accesses[i].data - reference));
+    }
+    frame[0] = keyframe ? TMC5130_RECORDER_SYNC_KEY : TMC5130_RECORDER_SYNC_DELTA;
+    frame[1] = size - 2;
+    uint8_t checksum = 0;
+    for (size_t i = 2; i < size; i++) {
+        checksum += frame[i];
+    }
+    frame[size++] = checksum;
+
+    /* Store it, or drop it and force a key frame so the decoder can resynchronize */
+    if (ring_free() < size) {
+        m_dropped++;
+        m_keyframe_countdown = 0;
+        return 1;
+    }
+    ring_push(frame, size);
+    for (uint8_t i = 0; i < m_count; i++) {
+        m_values[i] = accesses[i].data;
+    }
+    m_time_last = time_us;
+    m_started = true;
+    m_keyframe_countdown = keyframe ? TMC5130_RECORDER_KEYFRAME_INTERVAL : (m_keyframe_countdown - 1);
+
+    /* Return sample taken */
+    return 1;
+}
+
+/**
+ * Retrieves recorded bytes from the ring buffer.
+ * @param[out] data
+ * @param[in] size The maximum number of bytes to retrieve.
+ * @return The number of bytes retrieved.
+ */
+size_t tmc5130_recorder::read(uint8_t *const data, const size_t size) {
+    size_t count = 0;
+    while (count < size && m_tail != m_head) {
+        data[count++] = m_buffer[m_tail];
+        m_tail = (m_tail + 1) % m_buffer_size;
+    }
+    return count;
+}
+
+#if defined(ARDUINO)
+/**
+ * Writes recorded bytes to the given output, within the room it reports, so it never blocks.
+ * Nothing is written if the output reports no room, including outputs that do not implement availableForWrite.
+ * @param[in] output For example Serial.
+ * @return The number of bytes written.
+ */
+int tmc5130_recorder::stream(Print &output) {
+    int room = output.availableForWrite();
+    if (room <= 0) {
+        return 0;
+    }
+    return stream(output, room);
+}
+
+/**
+ * Writes recorded bytes to the given output, within an explicit byte budget.
+ * This is meant for outputs that do not implement availableForWrite, but whose room is known otherwise.
+ * @param[in] output
+ * @param[in] budget The maximum number of bytes to write.
+ * @return The number of bytes written.
+ */
+int tmc5130_recorder::stream(Print &output, const size_t budget) {
+    size_t available = m_buffer_size - 1 - ring_free();
+    if (budget < available) {
+        available = budget;
+    }
+    size_t written = 0;
+    while (written < available) {
+        size_t chunk = (m_tail < m_head) ? (m_head - m_tail) : (m_buffer_size - m_tail);
+        if (chunk > available - written) {
+            chunk = available - written;
+        }
+        size_t done = output.write(&m_buffer[m_tail], chunk);
+        m_tail = (m_tail + done) % m_buffer_size;
+        written += done;
+        if (done < chunk) {
+            break;
+        }
+    }
+    return written;
+}
+#endif
+
+/**
+ *
+ * @return The number of bytes that can be pushed into the ring buffer.
+ */
+size_t tmc5130_recorder::ring_free(void) const {
+    return (m_tail + m_buffer_size - m_head - 1) % m_buffer_size;
+}
+
+/**
+ *
+ * @param[in] data
+ * @param[in] size
+ */
+void tmc5130_recorder::ring_push(const uint8_t *const data, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        m_buffer[m_head] = data[i];
+        m_head = (m_head + 1) % m_buffer_size;
+    }
+}
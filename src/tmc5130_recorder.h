@@ -0,0 +1,59 @@
+#ifndef TMC5130_RECORDER_H
+#define TMC5130_RECORDER_H
+
+/* Library header */
+#include "tmc5130.h"
+
+/* Maximum number of registers sampled */
+#ifndef TMC5130_RECORDER_REGISTERS_MAX
+#define TMC5130_RECORDER_REGISTERS_MAX 8
+#endif
+
+/* Number of frames between two key frames */
+#ifndef TMC5130_RECORDER_KEYFRAME_INTERVAL
+#define TMC5130_RECORDER_KEYFRAME_INTERVAL 64
+#endif
+
+/**
+ * Samples a set of registers at a fixed period and stores them as compact binary frames in a ram ring buffer.
+ *
+ * Each frame is made of a sync byte, a payload length, the payload and a checksum (sum of the payload bytes).
+ * - Key frames (sync 0xA6) carry the number of registers, their addresses, the absolute time and the register values.
+ * - Delta frames (sync 0xA5) carry the time elapsed and the difference of each register with the previous frame.
+ * All numbers are zigzag encoded varints. A key frame is emitted periodically and after frames had to be dropped.
+ * Use extras/tmc5130_decode.py to turn a capture into csv.
+ */
+class tmc5130_recorder {
+
+   public:
+    int setup(tmc5130 &driver, const uint8_t *const addresses, const size_t count, const uint32_t period_us, uint8_t *const buffer, const size_t buffer_size);
+    int sample(const uint32_t time_us);
+    size_t read(uint8_t *const data, const size_t size);
+#if defined(ARDUINO)
+    int stream(Print &output);
+    int stream(Print &output, const size_t budget);
+#endif
+    uint32_t dropped_count(void) const {
+        return m_dropped;
+    }
+
+   protected:
+    size_t ring_free(void) const;
+    void ring_push(const uint8_t *const data, const size_t size);
+    tmc5130 *m_driver = NULL;
+    uint8_t m_addresses[TMC5130_RECORDER_REGISTERS_MAX];
+    uint32_t m_values[TMC5130_RECORDER_REGISTERS_MAX];
+    uint8_t m_count = 0;
+    uint32_t m_period_us;
+    uint32_t m_time_next;
+    uint32_t m_time_last;
+    uint8_t *m_buffer = NULL;
+    size_t m_buffer_size;
+    size_t m_head;
+    size_t m_tail;
+    uint32_t m_dropped;
+    uint8_t m_keyframe_countdown;
+    bool m_started;
+};
+
+#endif
@@ -0,0 +1,369 @@
+/* Self header */
+#include "tmc5130_scurve.h"
+
+/**
+ *
+ * @param[in] driver The driver of the axis.
+ * @param[in] speed The maximum velocity, in steps/s.
+ * @param[in] acceleration The maximum acceleration and deceleration, in steps/s^2.
+ * @param[in] jerk The maximum jerk, in steps/s^3.
+ * @param[in] period_us The period at which update will be called, in microseconds.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If one of the parameters is not valid
+ */
+int tmc5130_scurve::setup(tmc5130 &driver, const float speed, const float acceleration, const float jerk, const uint32_t period_us) {
+
+    /* Ensure parameters are valid */
+    if (!(speed > 0) || !(acceleration > 0) || !(jerk > 0) || period_us == 0) {
+        return -EINVAL;
+    }
+
+    /* Save parameters */
+    m_driver = &driver;
+    m_speed = speed;
+    m_acceleration = acceleration;
+    m_jerk = jerk;
+    m_period_us = period_us;
+    m_state = STATE_IDLE;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Starts a move to the given position.
+ * @param[in] position The target position, in steps.
+ * @param[in] time_us The current time in microseconds, such as returned by micros(), used as origin of the profile.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If setup has not been done
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_scurve::start(const float position, const uint32_t time_us) {
+
+    /* Ensure setup has been done */
+    if (m_driver == NULL) {
+        return -EINVAL;
+    }
+
+    /* Compute profile from the distance to travel */
+    float position_current;
+    if (m_driver->position_current_get(position_current) < 0) {
+        return -EIO;
+    }
+    profile_compute(fabs(position - position_current));
+
+    /* Let the driver select its microstep resolution for this speed now, with a move to the current position,
+     * so the values streamed afterwards are in the right unit */
+    int res = 0;
+    res |= m_driver->speed_limit_set(m_speed);
+    res |= m_driver->move_to_position(position_current);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Write the first period, then start the move */
+    m_position_start = position_current;
+    m_position_end = position;
+    m_time_start = time_us;
+    m_tick = 0;
+    m_fallback = false;
+    m_state = STATE_STREAMING;
+    if (profile_write(0.0f, fabs(position - position_current)) < 0 || m_driver->move_to_position(position) < 0) {
+        m_state = STATE_IDLE;
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Writes the ramp registers for the current update period, this should be called at the period given at setup.
+ * @param[in] time_us The current time in microseconds, such as returned by micros().
+ * @return 1 if the move is in progress, 0 once the target is reached, or a negative error code otherwise, in particular:
+ *  -EINVAL If no move has been started
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_scurve::update(const uint32_t time_us) {
+    int res;
+
+    switch (m_state) {
+
+        case STATE_STREAMING: {
+
+            /* Nothing to do until the next period */
+            uint32_t tick = (time_us - m_time_start) / m_period_us;
+            if (tick == m_tick) {
+                return 1;
+            }
+
+            /* If a period was missed, the ramp generator went on with stale values, so finish as a trapezoid right away */
+            if (tick > m_tick + 1) {
+                m_fallback = true;
+                m_state = STATE_FINISHING;
+                return (trapezoid_restore() < 0) ? -EIO : 1;
+            }
+            m_tick = tick;
+
+            /* Find where the axis is on the profile from its actual position, so the profile follows the motor and not the clock */
+            float position;
+            if (m_driver->position_current_get(position) < 0) {
+                return -EIO;
+            }
+            const float distance = fabs(m_position_end - m_position_start);
+            const float travelled = (m_position_end >= m_position_start) ? position - m_position_start : m_position_start - position;
+            const float time = profile_time_get(travelled);
+
+            /* Once the profile is over, let the ramp generator creep to the target, which is no more than a few microsteps away */
+            const float period = m_period_us / 1000000.0f;
+            if (time + period >= m_time_total) {
+                if (m_driver->register_write(tmc5130::VMAX, m_driver->convert_velocity_to_tmc(m_jerk * period * period / 2.0f)) < 0) {
+                    return -EIO;
+                }
+                m_state = STATE_FINISHING;
+                return 1;
+            }
+
+            /* Write this period */
+            if (profile_write(time, distance - travelled) < 0) {
+                return -EIO;
+            }
+            return 1;
+        }
+
+        case STATE_FINISHING: {
+
+            /* Wait for the target */
+            res = m_driver->target_position_reached_is();
+            if (res < 0) {
+                return -EIO;
+            }
+            if (res == 0) {
+                return 1;
+            }
+
+            /* Leave the plain limits in place for the next moves */
+            m_state = STATE_IDLE;
+            if (!m_fallback && trapezoid_restore() < 0) {
+                return -EIO;
+            }
+            return 0;
+        }
+
+        default: {
+            return -EINVAL;
+        }
+    }
+}
+
+/**
+ *
+ * @return 1 if the last move had to fall back to a trapezoid because an update was missed, 0 otherwise.
+ */
+int tmc5130_scurve::fallback_is(void) const {
+    return m_fallback ? 1 : 0;
+}
+
+/**
+ * Computes the durations of the phases of a rest to rest move.
+ * The peak velocity is lowered when the distance is too short to reach the speed limit.
+ * @param[in] distance The distance to travel, in steps.
+ */
+void tmc5130_scurve::profile_compute(const float distance) {
+
+    /* Search for the highest peak velocity whose acceleration and deceleration fit in the distance */
+    float velocity_low = 0.0f;
+    float velocity_high = m_speed;
+    for (uint8_t i = 0; i < 32; i++) {
+
+        /* Compute acceleration phases for this velocity, the acceleration limit is only reached if the velocity is high enough */
+        float velocity = (i == 0) ? m_speed : (velocity_low + velocity_high) / 2.0f;
+        if (velocity * m_jerk >= m_acceleration * m_acceleration) {
+            m_time_jerk = m_acceleration / m_jerk;
+            m_time_constant = velocity / m_acceleration - m_time_jerk;
+            m_acceleration_peak = m_acceleration;
+        } else {
+            m_time_jerk = sqrtf(velocity / m_jerk);
+            m_time_constant = 0.0f;
+            m_acceleration_peak = m_jerk * m_time_jerk;
+        }
+        m_time_ramp = 2.0f * m_time_jerk + m_time_constant;
+        m_velocity_peak = velocity;
+
+        /* The acceleration and the deceleration each travel velocity * m_time_ramp / 2 */
+        float distance_ramps = velocity * m_time_ramp;
+        if (i == 0 && distance_ramps <= distance) {
+            break;
+        }
+        if (distance_ramps > distance) {
+            velocity_high = velocity;
+        } else {
+            velocity_low = velocity;
+        }
+    }
+
+    /* Cruise for the remaining distance */
+    float time_cruise = 0.0f;
+    if (m_velocity_peak > 0.0f) {
+        time_cruise = (distance - m_velocity_peak * m_time_ramp) / m_velocity_peak;
+        if (time_cruise < 0.0f) time_cruise = 0.0f;
+    }
+    m_time_total = 2.0f * m_time_ramp + time_cruise;
+}
+
+/**
+ * Evaluates the velocity of the acceleration part of the profile.
+ * @param[in] time The time since the beginning of the acceleration, in s.
+ * @return The velocity in steps/s.
+ */
+float tmc5130_scurve::profile_ramp_velocity_get(const float time) const {
+    if (time <= 0.0f) {
+        return 0.0f;
+    } else if (time < m_time_jerk) {
+        return m_jerk * time * time / 2.0f;
+    } else if (time < m_time_jerk + m_time_constant) {
+        return m_jerk * m_time_jerk * m_time_jerk / 2.0f + m_acceleration_peak * (time - m_time_jerk);
+    } else if (time < m_time_ramp) {
+        float remaining = m_time_ramp - time;
+        return m_velocity_peak - m_jerk * remaining * remaining / 2.0f;
+    } else {
+        return m_velocity_peak;
+    }
+}
+
+/**
+ * Evaluates the velocity of the profile, the deceleration mirroring the acceleration.
+ * @param[in] time The time since the beginning of the move, in s.
+ * @return The velocity in steps/s.
+ */
+float tmc5130_scurve::profile_velocity_get(const float time) const {
+    if (time < m_time_total - m_time_ramp) {
+        return profile_ramp_velocity_get(time);
+    } else {
+        return profile_ramp_velocity_get(m_time_total - time);
+    }
+}
+
+/**
+ * Evaluates the distance travelled by the acceleration part of the profile.
+ * @param[in] time The time since the beginning of the acceleration, in s.
+ * @return The distance in steps, growing at the peak velocity after the acceleration.
+ */
+float tmc5130_scurve::profile_ramp_distance_get(const float time) const {
+    const float distance_ramp = m_velocity_peak * m_time_ramp / 2.0f;
+    if (time <= 0.0f) {
+        return 0.0f;
+    } else if (time < m_time_jerk) {
+        return m_jerk * time * time * time / 6.0f;
+    } else if (time < m_time_jerk + m_time_constant) {
+        float elapsed = time - m_time_jerk;
+        return m_jerk * m_time_jerk * m_time_jerk * (m_time_jerk / 6.0f + elapsed / 2.0f) + m_acceleration_peak * elapsed * elapsed / 2.0f;
+    } else if (time < m_time_ramp) {
+        float remaining = m_time_ramp - time;
+        return distance_ramp - m_velocity_peak * remaining + m_jerk * remaining * remaining * remaining / 6.0f;
+    } else {
+        return distance_ramp + m_velocity_peak * (time - m_time_ramp);
+    }
+}
+
+/**
+ * Evaluates the distance travelled along the profile, the deceleration mirroring the acceleration.
+ * @param[in] time The time since the beginning of the move, in s.
+ * @return The distance in steps.
+ */
+float tmc5130_scurve::profile_distance_get(const float time) const {
+    if (time < m_time_total - m_time_ramp) {
+        return profile_ramp_distance_get(time);
+    } else {
+        return m_velocity_peak * (m_time_total - m_time_ramp) - profile_ramp_distance_get(m_time_total - time);
+    }
+}
+
+/**
+ * Finds the time at which the profile has travelled a distance, the profile being monotonic.
+ * @param[in] distance The distance in steps.
+ * @return The time since the beginning of the move, in s, from 0 to the duration of the move.
+ */
+float tmc5130_scurve::profile_time_get(const float distance) const {
+    float time_low = 0.0f;
+    float time_high = m_time_total;
+    for (uint8_t i = 0; i < 24; i++) {
+        float time = (time_low + time_high) / 2.0f;
+        if (profile_distance_get(time) > distance) {
+            time_high = time;
+        } else {
+            time_low = time;
+        }
+    }
+    return time_low;
+}
+
+/**
+ * Writes the ramp registers so the ramp generator follows the profile during one update period, the velocity being shaped through VMAX.
+ * While the velocity increases, DMAX stays at the acceleration limit so the ramp generator does not start braking early on its own.
+ * While it decreases, DMAX is kept a quarter above the deceleration needed to stop in the remaining distance, or more,
+ * so the ramp generator can always stop on the target even if the next update comes late, but does not brake on its own before VMAX asks it to.
+ * VMAX is also kept above a small velocity so the ramp generator does not stop before the target.
+ * @param[in] time The point of the profile the period starts at, in s.
+ * @param[in] remaining The distance left to the target, in steps.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_scurve::profile_write(const float time, const float remaining) {
+
+    /* Compute velocities at both ends of the period, and the acceleration between them */
+    const float period = m_period_us / 1000000.0f;
+    const float velocity_begin = profile_velocity_get(time);
+    const float velocity_end = profile_velocity_get(time + period);
+    const float rate = fabs(velocity_end - velocity_begin) / period;
+    uint32_t reg_rate = m_driver->convert_acceleration_to_tmc(rate);
+    uint32_t reg_limit = m_driver->convert_acceleration_to_tmc(m_acceleration);
+    if (reg_rate > 0xFFFF) reg_rate = 0xFFFF;
+    if (reg_rate < 1) reg_rate = 1;
+    if (reg_limit > 0xFFFF) reg_limit = 0xFFFF;
+
+    /* Compute the deceleration, from the velocity the axis may have reached at the end of the period */
+    const bool accelerating = (velocity_end >= velocity_begin);
+    float velocity_max = velocity_end;
+    uint32_t reg_deceleration = reg_limit;
+    if (!accelerating) {
+        const float velocity_creep = m_jerk * period * period / 2.0f;
+        if (velocity_max < velocity_creep) velocity_max = velocity_creep;
+        const float stop = (remaining > 0.0f) ? velocity_begin * velocity_begin / (2.0f * remaining) : m_acceleration;
+        uint32_t reg_stop = m_driver->convert_acceleration_to_tmc(stop);
+        reg_deceleration = reg_stop + reg_stop / 4;
+        if (reg_deceleration < reg_rate) reg_deceleration = reg_rate;
+        if (reg_deceleration > reg_limit) reg_deceleration = (reg_stop > reg_limit) ? reg_stop + 1 : reg_limit;
+        if (reg_deceleration > 0xFFFF) reg_deceleration = 0xFFFF;
+    }
+
+    /* Write acceleration, deceleration and velocity in a single batch */
+    struct tmc5130::access accesses[] = {
+        {tmc5130::AMAX, true, reg_rate},
+        {tmc5130::A_1, true, reg_rate},
+        {tmc5130::DMAX, true, reg_deceleration},
+        {tmc5130::D_1, true, reg_deceleration},
+        {tmc5130::VMAX, true, m_driver->convert_velocity_to_tmc(velocity_max)},
+    };
+    if (m_driver->register_batch(accesses, 5) < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Writes the plain speed and acceleration limits back.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_scurve::trapezoid_restore(void) {
+    int res = 0;
+    res |= m_driver->acceleration_limit_set(m_acceleration);
+    res |= m_driver->speed_limit_set(m_speed);
+    if (res < 0) {
+        return -EIO;
+    }
+    return 0;
+}
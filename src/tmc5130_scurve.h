@@ -0,0 +1,58 @@
+#ifndef TMC5130_SCURVE_H
+#define TMC5130_SCURVE_H
+
+/* Library header */
+#include "tmc5130.h"
+
+/**
+ * Jerk limited positioning moves, on top of the constant acceleration ramp generator.
+ *
+ * At start, the seven phase S-curve profile of the move is computed from the speed, acceleration and jerk limits.
+ * The move is then started in positioning mode, and at each update period XACTUAL is read to find where the axis is on the profile,
+ * and AMAX, DMAX, A1, D1 and VMAX are written so the ramp generator goes from the profile velocity at that point to the one a period later.
+ * The velocity is shaped through VMAX, while DMAX and D1 never go below what is needed to stop in the remaining distance,
+ * so the ramp generator, which handles the target itself, always ends the move exactly on it without overshooting.
+ * If an update period is missed, the plain speed and acceleration limits are written back and the move finishes as a trapezoid.
+ */
+class tmc5130_scurve {
+
+   public:
+    int setup(tmc5130 &driver, const float speed, const float acceleration, const float jerk, const uint32_t period_us = 10000);
+    int start(const float position, const uint32_t time_us);
+    int update(const uint32_t time_us);
+    int fallback_is(void) const;
+
+   protected:
+    enum state {
+        STATE_IDLE,
+        STATE_STREAMING,
+        STATE_FINISHING,
+    };
+    void profile_compute(const float distance);
+    float profile_velocity_get(const float time) const;
+    float profile_ramp_velocity_get(const float time) const;
+    float profile_distance_get(const float time) const;
+    float profile_ramp_distance_get(const float time) const;
+    float profile_time_get(const float distance) const;
+    int profile_write(const float time, const float remaining);
+    int trapezoid_restore(void);
+    tmc5130 *m_driver = NULL;
+    float m_speed;
+    float m_acceleration;
+    float m_jerk;
+    uint32_t m_period_us;
+    float m_time_jerk;      //!< Duration of each jerk phase of the acceleration, in s
+    float m_time_constant;  //!< Duration of the constant acceleration phase, in s
+    float m_time_ramp;      //!< Duration of the whole acceleration, and of the whole deceleration, in s
+    float m_time_total;     //!< Duration of the move, in s
+    float m_velocity_peak;  //!< Velocity reached by the move, in steps/s
+    float m_acceleration_peak;
+    float m_position_start;  //!< Position at the beginning of the move, in steps
+    float m_position_end;    //!< Target of the move, in steps
+    uint32_t m_time_start;
+    uint32_t m_tick;  //!< Index of the last update period written
+    bool m_fallback = false;
+    enum state m_state = STATE_IDLE;
+};
+
+#endif
@@ -0,0 +1,254 @@
+/* Self header */
+#include "tmc5130_spi_bus.h"
+
+#if defined(ARDUINO)
+
+/**
+ *
+ * @param[in] spi_library
+ * @param[in] spi_speed
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spi_bus::setup(SPIClass &spi_library, const int spi_speed) {
+
+    /* Ensure spi speed is within supported range */
+    if (spi_speed > 8000000) {
+        return -EINVAL;
+    }
+
+    /* Save spi settings */
+    m_spi_library = &spi_library;
+    m_spi_settings = SPISettings(spi_speed, MSBFIRST, SPI_MODE3);
+
+    /* Forget drivers */
+    m_drivers_count = 0;
+    m_driver_first = 0;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Registers a driver on this bus.
+ * @note The driver must have been setup with the same spi library as the bus.
+ * @param[in] driver
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the bus or driver has not been setup, or if they use a different spi library
+ *  -ENOSPC If the maximum number of drivers has been reached
+ */
+int tmc5130_spi_bus::driver_add(tmc5130_spi &driver) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure driver and bus match */
+    if (m_spi_library == NULL || driver.m_spi_library != m_spi_library) {
+        return -EINVAL;
+    }
+
+    /* Ignore drivers already added */
+    if (driver_index_get(driver) >= 0) {
+        return 0;
+    }
+
+    /* Add driver */
+    if (m_drivers_count >= TMC5130_SPI_BUS_DRIVERS_MAX) {
+        return -ENOSPC;
+    }
+    m_drivers[m_drivers_count] = &driver;
+    for (uint8_t p = 0; p < PRIORITY_COUNT; p++) {
+        m_queues[m_drivers_count][p].count = 0;
+    }
+    m_failed[m_drivers_count] = false;
+    m_drivers_count++;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Queues a register write, to be performed at the next call to process().
+ * @param[in] driver
+ * @param[in] address
+ * @param[in] data
+ * @param[in] priority
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the driver has not been added to this bus
+ *  -ENOSPC If the queue of the driver is full
+ */
+int tmc5130_spi_bus::register_write_queue(tmc5130_spi &driver, const uint8_t address, const uint32_t data, const enum priority priority) {
+    tmc5130_lock_guard lock(m_lock);
+    struct tmc5130::access access = {address, true, data};
+    return operation_queue(driver, access, NULL, priority);
+}
+
+/**
+ * Queues a register read, to be performed at the next call to process().
+ * @param[in] driver
+ * @param[in] address
+ * @param[out] data Where to store the value read, must remain valid until process() has been called.
+ * @param[in] priority
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the driver has not been added to this bus
+ *  -ENOSPC If the queue of the driver is full
+ */
+int tmc5130_spi_bus::register_read_queue(tmc5130_spi &driver, const uint8_t address, uint32_t *const data, const enum priority priority) {
+    tmc5130_lock_guard lock(m_lock);
+    struct tmc5130::access access = {address, false, 0};
+    if (data == NULL) {
+        return -EINVAL;
+    }
+    return operation_queue(driver, access, data, priority);
+}
+
+/**
+ * Performs the queued operations in a single bus transaction.
+ * Priorities are served in order, and within a priority the drivers are served in a round-robin fashion.
+ * When a frame budget is given, operations that do not fit remain queued for the next call.
+ * @param[in] frames_max The maximum number of datagrams to send.
+ * @param[out] performed If not NULL, the number of operations performed, including when an error is returned for another device.
+ * @return The number of operations performed in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the bus has not been setup
+ *  -EIO If there was an error communicating with one of the devices
+ * @note The operations of a device that failed are kept queued and sent again at the next call, as it cannot be known which of them went through.
+ * Their destinations are left untouched until then, driver_error_get() tells which device failed.
+ */
+int tmc5130_spi_bus::process(const size_t frames_max, size_t *const performed) {
+    int res = 0;
+    size_t frames = 0;
+    int operations = 0;
+    if (performed != NULL) {
+        *performed = 0;
+    }
+
+    /* Ensure setup has been done */
+    if (m_spi_library == NULL) {
+        return -EINVAL;
+    }
+
+    /* Serve drivers */
+    tmc5130_lock_guard lock(m_lock);
+    m_spi_library->beginTransaction(m_spi_settings);
+    for (uint8_t p = 0; p < PRIORITY_COUNT; p++) {
+        for (uint8_t n = 0; n < m_drivers_count; n++) {
+            uint8_t d = (m_driver_first + n) % m_drivers_count;
+            struct queue &queue = m_queues[d][p];
+            if (queue.count == 0) continue;
+
+            /* Take as many operations as the budget allows, keeping one spare frame for a trailing read */
+            size_t count = queue.count;
+            if (frames + count + 1 > frames_max) {
+                count = (frames_max > frames + 1) ? (frames_max - frames - 1) : 0;
+            }
+            if (count == 0) continue;
+
+            /* Send them back to back */
+            if (m_drivers[d]->frames_transfer(queue.accesses, count) < 0) {
+                res = -EIO;
+                m_failed[d] = true;
+                continue;
+            }
+            frames += count + (queue.accesses[count - 1].write ? 0 : 1);
+            operations += count;
+
+            /* Deliver read data */
+            for (size_t i = 0; i < count; i++) {
+                if (queue.destinations[i] != NULL) {
+                    *queue.destinations[i] = queue.accesses[i].data;
+                }
+            }
+
+            /* Keep remaining operations */
+            queue.count -= count;
+            memmove(queue.accesses, &queue.accesses[count], queue.count * sizeof(queue.accesses[0]));
+            memmove(queue.destinations, &queue.destinations[count], queue.count * sizeof(queue.destinations[0]));
+        }
+    }
+    m_spi_library->endTransaction();
+
+    /* Rotate the driver served first */
+    if (m_drivers_count > 0) {
+        m_driver_first = (m_driver_first + 1) % m_drivers_count;
+    }
+
+    /* Return number of operations or error */
+    if (performed != NULL) {
+        *performed = operations;
+    }
+    if (res < 0) {
+        return res;
+    }
+    return operations;
+}
+
+/**
+ * Tells whether the operations of a driver failed since the last call, and clears this state.
+ * @param[in] driver
+ * @return 0 if there was no error, or a negative error code otherwise, in particular:
+ *  -EINVAL If the driver has not been added to this bus
+ *  -EIO If a transfer to this driver failed, its operations are still queued
+ */
+int tmc5130_spi_bus::driver_error_get(tmc5130_spi &driver) {
+    tmc5130_lock_guard lock(m_lock);
+    int d = driver_index_get(driver);
+    if (d < 0) {
+        return -EINVAL;
+    }
+    bool failed = m_failed[d];
+    m_failed[d] = false;
+    return failed ? -EIO : 0;
+}
+
+/**
+ *
+ * @param[in] driver
+ * @return The index of the driver, or -1 if it has not been added to this bus.
+ */
+int tmc5130_spi_bus::driver_index_get(const tmc5130_spi &driver) {
+    for (uint8_t d = 0; d < m_drivers_count; d++) {
+        if (m_drivers[d] == &driver) {
+            return d;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Appends an operation to the queue of a driver, the lock must be held.
+ * @param[in] driver
+ * @param[in] access
+ * @param[in] destination
+ * @param[in] priority
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spi_bus::operation_queue(tmc5130_spi &driver, const struct tmc5130::access &access, uint32_t *const destination, const enum priority priority) {
+
+    /* Ensure parameters are valid */
+    if (priority >= PRIORITY_COUNT) {
+        return -EINVAL;
+    }
+    int d = driver_index_get(driver);
+    if (d < 0) {
+        return -EINVAL;
+    }
+
+    /* Append operation */
+    struct queue &queue = m_queues[d][priority];
+    if (queue.count >= TMC5130_SPI_BUS_QUEUE_LENGTH) {
+        return -ENOSPC;
+    }
+    queue.accesses[queue.count] = access;
+    queue.destinations[queue.count] = destination;
+    queue.count++;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Installs a lock that is held while the bus is in use.
+ * @param[in] lock The lock, which must be recursive, or NULL to disable locking.
+ */
+void tmc5130_spi_bus::lock_set(tmc5130_lock *const lock) {
+    m_lock = lock;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef TMC5130_SPI_BUS_H
+#define TMC5130_SPI_BUS_H
+
+/* Library header */
+#include "tmc5130.h"
+
+#if defined(ARDUINO)
+
+/* Maximum number of drivers sharing a bus */
+#ifndef TMC5130_SPI_BUS_DRIVERS_MAX
+#define TMC5130_SPI_BUS_DRIVERS_MAX 16
+#endif
+
+/* Maximum number of pending operations per driver and per priority */
+#ifndef TMC5130_SPI_BUS_QUEUE_LENGTH
+#define TMC5130_SPI_BUS_QUEUE_LENGTH 8
+#endif
+
+/**
+ * Coordinates the register accesses of several drivers sharing the same spi bus with independent chip selects.
+ * Operations are queued per driver and per priority, then processed in a single bus transaction:
+ * commands of all drivers go first, then telemetry, and the driver served first rotates at each cycle.
+ * The pending operations of a driver are sent as back-to-back datagrams, with pipelined reads.
+ * @note When drivers on the bus are also accessed directly from other tasks, give the bus and all of these drivers the same lock.
+ */
+class tmc5130_spi_bus {
+
+   public:
+    enum priority {
+        PRIORITY_COMMAND = 0,  // Writes that affect motion, served first
+        PRIORITY_TELEMETRY,    // Status and position readings, served with the remaining budget
+        PRIORITY_COUNT,
+    };
+    int setup(SPIClass &spi_library, const int spi_speed = 4000000);
+    int driver_add(tmc5130_spi &driver);
+    int register_write_queue(tmc5130_spi &driver, const uint8_t address, const uint32_t data, const enum priority priority = PRIORITY_COMMAND);
+    int register_read_queue(tmc5130_spi &driver, const uint8_t address, uint32_t *const data, const enum priority priority = PRIORITY_TELEMETRY);
+    int process(const size_t frames_max = SIZE_MAX, size_t *const performed = NULL);
+    int driver_error_get(tmc5130_spi &driver);
+    void lock_set(tmc5130_lock *const lock);
+
+   protected:
+    struct queue {
+        struct tmc5130::access accesses[TMC5130_SPI_BUS_QUEUE_LENGTH];
+        uint32_t *destinations[TMC5130_SPI_BUS_QUEUE_LENGTH];
+        uint8_t count;
+    };
+    int driver_index_get(const tmc5130_spi &driver);
+    int operation_queue(tmc5130_spi &driver, const struct tmc5130::access &access, uint32_t *const destination, const enum priority priority);
+    tmc5130_lock *m_lock = NULL;  //!< Optional lock held while the bus is in use
+    SPIClass *m_spi_library = NULL;
+    SPISettings m_spi_settings;
+    tmc5130_spi *m_drivers[TMC5130_SPI_BUS_DRIVERS_MAX];
+    struct queue m_queues[TMC5130_SPI_BUS_DRIVERS_MAX][PRIORITY_COUNT];
+    bool m_failed[TMC5130_SPI_BUS_DRIVERS_MAX] = {false};  //!< Whether a transfer to each driver failed since driver_error_get was last called
+    uint8_t m_drivers_count = 0;
+    uint8_t m_driver_first = 0;  //!< Index of the driver served first at the next cycle
+};
+
+#endif
+
+#endif
@@ -0,0 +1,305 @@
+/* Template definitions of tmc5130_spi_transport, included at the end of tmc5130.h */
+#ifndef TMC5130_SPI_IMPL_H
+#define TMC5130_SPI_IMPL_H
+
+/* Macro for delay */
+#ifndef delayNanoseconds
+#define delayNanoseconds(X) delayMicroseconds(1)
+#endif
+
+/**
+ *
+ * @param[in] config
+ * @param[in] spi_library
+ * @param[in] spi_cs_pin
+ * @param[in] spi_speed
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::setup(struct tmc5130_common::config &config, SPIClass &spi_library, const int spi_cs_pin, const int spi_speed) {
+    int res = transport_setup(spi_library, spi_cs_pin, spi_speed);
+    if (res < 0) {
+        return res;
+    }
+    return base::setup(config);
+}
+
+/**
+ *
+ * @param[in] settings The registers whose value differ from the defaults.
+ * @param[in] count The number of settings.
+ * @param[in] spi_library
+ * @param[in] spi_cs_pin
+ * @param[in] spi_speed
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::setup(const struct tmc5130_common::setting *const settings, const size_t count, SPIClass &spi_library, const int spi_cs_pin, const int spi_speed) {
+    int res = transport_setup(spi_library, spi_cs_pin, spi_speed);
+    if (res < 0) {
+        return res;
+    }
+    return base::setup(settings, count);
+}
+
+/**
+ *
+ * @return The amount of ram used by this instance, in bytes.
+ */
+template <class base>
+size_t tmc5130_spi_transport<base>::footprint_ram_get(void) const {
+    return sizeof(*this);
+}
+
+/**
+ *
+ * @param[in] spi_library
+ * @param[in] spi_cs_pin
+ * @param[in] spi_speed
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::transport_setup(SPIClass &spi_library, const int spi_cs_pin, const int spi_speed) {
+
+    /* Ensure spi speed is within supported range */
+    if (spi_speed > 8000000) {
+        return -EINVAL;
+    }
+
+    /* Save spi settings */
+    m_spi_library = &spi_library;
+    m_spi_settings = SPISettings(spi_speed, MSBFIRST, SPI_MODE3);
+    m_spi_cs_pin = spi_cs_pin;
+
+    /* Configure cs pin */
+    pinMode(m_spi_cs_pin, OUTPUT);
+    digitalWrite(m_spi_cs_pin, HIGH);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[out] status
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::status_read(uint8_t &status) {
+    tmc5130_lock_guard lock(this->m_lock);
+
+    /* Ensure setup has been done */
+    if (m_spi_library == NULL) {
+        return -EINVAL;
+    }
+
+    /* Read any register to extract the status byte */
+    m_spi_library->beginTransaction(m_spi_settings);
+    digitalWrite(m_spi_cs_pin, LOW);
+    status = m_spi_library->transfer(tmc5130_common::GCONF & 0x7F);
+    m_spi_library->transfer(0x00);
+    m_spi_library->transfer(0x00);
+    m_spi_library->transfer(0x00);
+    m_spi_library->transfer(0x00);
+    digitalWrite(m_spi_cs_pin, HIGH);
+    m_spi_library->endTransaction();
+    TMC5130_TRACE_RECORD(tmc5130_common::GCONF, tmc5130_trace::FLAG_STATUS, status, 0);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] address
+ * @param[out] data
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::register_read(const uint8_t address, uint32_t &data) {
+    tmc5130_lock_guard lock(this->m_lock);
+
+    /* Ensure setup has been done */
+    if (m_spi_library == NULL) {
+        return -EINVAL;
+    }
+
+    /* Send address with dummy data bytes */
+    m_spi_library->beginTransaction(m_spi_settings);
+    digitalWrite(m_spi_cs_pin, LOW);
+    this->m_status_byte = m_spi_library->transfer(address & 0x7F);
+    if (this->m_status_byte == 0xFF) {
+        digitalWrite(m_spi_cs_pin, HIGH);
+        delayNanoseconds(10);
+        m_spi_library->endTransaction();
+        TMC5130_TRACE_RECORD(address, tmc5130_trace::FLAG_ERROR, this->m_status_byte, 0);
+        return -EIO;
+    }
+    m_spi_library->transfer(0x00);
+    m_spi_library->transfer(0x00);
+    m_spi_library->transfer(0x00);
+    m_spi_library->transfer(0x00);
+    digitalWrite(m_spi_cs_pin, HIGH);
+    delayNanoseconds(10);
+
+    /* Wait */
+    delayMicroseconds(10);
+
+    /* Read data from previously selected address */
+    digitalWrite(m_spi_cs_pin, LOW);
+    this->m_status_byte = m_spi_library->transfer(address & 0x7F);
+    if (this->m_status_byte == 0xFF) {
+        digitalWrite(m_spi_cs_pin, HIGH);
+        m_spi_library->endTransaction();
+        TMC5130_TRACE_RECORD(address, tmc5130_trace::FLAG_ERROR, this->m_status_byte, 0);
+        return -EIO;
+    }
+    data = m_spi_library->transfer(0x00);
+    data <<= 8;
+    data |= m_spi_library->transfer(0x00);
+    data <<= 8;
+    data |= m_spi_library->transfer(0x00);
+    data <<= 8;
+    data |= m_spi_library->transfer(0x00);
+    digitalWrite(m_spi_cs_pin, HIGH);
+    delayNanoseconds(10);
+    m_spi_library->endTransaction();
+    TMC5130_TRACE_RECORD(address, 0, this->m_status_byte, data);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] address
+ * @param[in] data
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::register_write(const uint8_t address, const uint32_t data) {
+    tmc5130_lock_guard lock(this->m_lock);
+
+    /* Ensure setup has been done */
+    if (m_spi_library == NULL) {
+        return -EINVAL;
+    }
+
+    /* Send address */
+    m_spi_library->beginTransaction(m_spi_settings);
+    digitalWrite(m_spi_cs_pin, LOW);
+    this->m_status_byte = m_spi_library->transfer(address | 0x80);
+    if (this->m_status_byte == 0xFF) {
+        digitalWrite(m_spi_cs_pin, HIGH);
+        delayNanoseconds(10);
+        m_spi_library->endTransaction();
+        TMC5130_TRACE_RECORD(address, tmc5130_trace::FLAG_WRITE | tmc5130_trace::FLAG_ERROR, this->m_status_byte, data);
+        return -EIO;
+    }
+
+    /* Send data */
+    m_spi_library->transfer(data >> 24);
+    m_spi_library->transfer(data >> 16);
+    m_spi_library->transfer(data >> 8);
+    m_spi_library->transfer(data);
+    digitalWrite(m_spi_cs_pin, HIGH);
+    delayNanoseconds(10);
+    m_spi_library->endTransaction();
+    TMC5130_TRACE_RECORD(address, tmc5130_trace::FLAG_WRITE, this->m_status_byte, data);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Performs a sequence of register accesses within a single spi transaction.
+ * @param[in,out] accesses The accesses to perform, the data of read accesses is filled in.
+ * @param[in] count The number of accesses.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::register_batch(struct tmc5130_common::access *const accesses, const size_t count) {
+    tmc5130_lock_guard lock(this->m_lock);
+
+    /* Ensure setup has been done */
+    if (m_spi_library == NULL) {
+        return -EINVAL;
+    }
+
+    /* Transfer frames */
+    m_spi_library->beginTransaction(m_spi_settings);
+    int res = frames_transfer(accesses, count);
+    m_spi_library->endTransaction();
+    return res;
+}
+
+/**
+ * Sends one datagram per access, back to back, without managing the spi transaction.
+ * Reads are pipelined: the data of a read request is clocked out during the following datagram, so a sequence of n reads only costs n + 1 datagrams.
+ * @note The caller is responsible for calling beginTransaction and endTransaction around this function.
+ * @param[in,out] accesses The accesses to perform, the data of read accesses is filled in.
+ * @param[in] count The number of accesses.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+template <class base>
+int tmc5130_spi_transport<base>::frames_transfer(struct tmc5130_common::access *const accesses, const size_t count) {
+    struct tmc5130_common::access *pending = NULL;
+
+    for (size_t i = 0; i <= count; i++) {
+
+        /* Select what to send: the next access, or a dummy read of the same register to retrieve the data of a final read */
+        uint8_t address;
+        uint32_t data_out = 0;
+        if (i < count) {
+            if (accesses[i].write) {
+                address = accesses[i].address | 0x80;
+                data_out = accesses[i].data;
+            } else {
+                address = accesses[i].address & 0x7F;
+            }
+        } else if (pending != NULL) {
+            address = pending->address & 0x7F;
+        } else {
+            break;
+        }
+
+        /* Send datagram */
+        digitalWrite(m_spi_cs_pin, LOW);
+        this->m_status_byte = m_spi_library->transfer(address);
+        if (this->m_status_byte == 0xFF) {
+            digitalWrite(m_spi_cs_pin, HIGH);
+            delayNanoseconds(10);
+            TMC5130_TRACE_RECORD(address & 0x7F, ((address & 0x80) ? tmc5130_trace::FLAG_WRITE : 0) | tmc5130_trace::FLAG_ERROR, this->m_status_byte, data_out);
+            return -EIO;
+        }
+        uint32_t data_in;
+        data_in = m_spi_library->transfer(data_out >> 24);
+        data_in <<= 8;
+        data_in |= m_spi_library->transfer(data_out >> 16);
+        data_in <<= 8;
+        data_in |= m_spi_library->transfer(data_out >> 8);
+        data_in <<= 8;
+        data_in |= m_spi_library->transfer(data_out);
+        digitalWrite(m_spi_cs_pin, HIGH);
+        delayNanoseconds(10);
+
+        /* The data received belongs to the previous read request, if any */
+        if (pending != NULL) {
+            pending->data = data_in;
+            TMC5130_TRACE_RECORD(pending->address, (i < count) ? tmc5130_trace::FLAG_PIPELINED : 0, this->m_status_byte, data_in);
+            pending = NULL;
+        }
+        if (i < count && accesses[i].write) {
+            TMC5130_TRACE_RECORD(accesses[i].address, tmc5130_trace::FLAG_WRITE, this->m_status_byte, accesses[i].data);
+        }
+        if (i < count && !accesses[i].write) {
+            pending = &accesses[i];
+            delayMicroseconds(10);
+        }
+    }
+
+    /* Return success */
+    return 0;
+}
+
+#endif
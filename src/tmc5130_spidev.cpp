@@ -0,0 +1,292 @@
+/* Self header */
+#include "tmc5130_spidev.h"
+
+#if defined(__linux__)
+
+/* Linux headers */
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/**
+ *
+ * @param[in] path
+ * @param[in] flags
+ * @return The file descriptor in case of success, or -1 otherwise.
+ */
+int tmc5130_spidev_io::open(const char *const path, const int flags) {
+    return ::open(path, flags);
+}
+
+/**
+ *
+ * @param[in] fd
+ * @param[in] request
+ * @param[in,out] argument
+ * @return A non-negative value in case of success, or -1 otherwise.
+ */
+int tmc5130_spidev_io::ioctl(const int fd, const unsigned long request, void *const argument) {
+    return ::ioctl(fd, request, argument);
+}
+
+/**
+ *
+ * @param[in] fd
+ * @return 0 in case of success, or -1 otherwise.
+ */
+int tmc5130_spidev_io::close(const int fd) {
+    return ::close(fd);
+}
+
+/**
+ *
+ */
+tmc5130_spidev::~tmc5130_spidev() {
+    if (m_fd >= 0) {
+        m_io->close(m_fd);
+    }
+}
+
+/**
+ *
+ * @param[in] config
+ * @param[in] device The spidev device path, for example /dev/spidev0.0
+ * @param[in] spi_speed
+ * @param[in] io The file descriptor layer to use, or NULL to use the system calls.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::setup(struct config &config, const char *const device, const uint32_t spi_speed, tmc5130_spidev_io *const io) {
+    int res = transport_setup(device, spi_speed, io);
+    if (res < 0) {
+        return res;
+    }
+    return tmc5130::setup(config);
+}
+
+/**
+ *
+ * @param[in] settings The registers whose value differ from the defaults.
+ * @param[in] count The number of settings.
+ * @param[in] device The spidev device path, for example /dev/spidev0.0
+ * @param[in] spi_speed
+ * @param[in] io The file descriptor layer to use, or NULL to use the system calls.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::setup(const struct setting *const settings, const size_t count, const char *const device, const uint32_t spi_speed, tmc5130_spidev_io *const io) {
+    int res = transport_setup(device, spi_speed, io);
+    if (res < 0) {
+        return res;
+    }
+    return tmc5130::setup(settings, count);
+}
+
+/**
+ *
+ * @return The amount of ram used by this instance, in bytes.
+ */
+size_t tmc5130_spidev::footprint_ram_get(void) const {
+    return sizeof(*this);
+}
+
+/**
+ *
+ * @param[in] device
+ * @param[in] spi_speed
+ * @param[in] io
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::transport_setup(const char *const device, const uint32_t spi_speed, tmc5130_spidev_io *const io) {
+
+    /* Ensure spi speed is within supported range */
+    if (device == NULL || spi_speed > 8000000) {
+        return -EINVAL;
+    }
+
+    /* Close previous device if any */
+    if (m_fd >= 0) {
+        m_io->close(m_fd);
+        m_fd = -1;
+    }
+    m_io = (io != NULL) ? io : &m_io_default;
+    m_spi_speed = spi_speed;
+
+    /* Open and configure device */
+    int fd = m_io->open(device, O_RDWR);
+    if (fd < 0) {
+        return -ENODEV;
+    }
+    uint8_t mode = SPI_MODE_3;
+    uint8_t bits = 8;
+    uint32_t speed = spi_speed;
+    if (m_io->ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+        m_io->ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        m_io->ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) < 0) {
+        m_io->close(fd);
+        return -EIO;
+    }
+    m_fd = fd;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[out] status
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::status_read(uint8_t &status) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure setup has been done */
+    if (m_fd < 0) {
+        return -EINVAL;
+    }
+
+    /* Read any register to extract the status byte */
+    uint8_t tx[5] = {GCONF & 0x7F, 0, 0, 0, 0};
+    uint8_t rx[5] = {0};
+    struct spi_ioc_transfer transfer;
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.tx_buf = (unsigned long)tx;
+    transfer.rx_buf = (unsigned long)rx;
+    transfer.len = 5;
+    transfer.speed_hz = m_spi_speed;
+    transfer.bits_per_word = 8;
+    if (m_io->ioctl(m_fd, SPI_IOC_MESSAGE(1), &transfer) < 0) {
+        return -EIO;
+    }
+    status = rx[0];
+    TMC5130_TRACE_RECORD(GCONF, tmc5130_trace::FLAG_STATUS, status, 0);
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ *
+ * @param[in] address
+ * @param[out] data
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::register_read(const uint8_t address, uint32_t &data) {
+    struct access access = {address, false, 0};
+    int res = register_batch(&access, 1);
+    if (res < 0) {
+        return res;
+    }
+    data = access.data;
+    return 0;
+}
+
+/**
+ *
+ * @param[in] address
+ * @param[in] data
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::register_write(const uint8_t address, const uint32_t data) {
+    struct access access = {address, true, data};
+    return register_batch(&access, 1);
+}
+
+/**
+ * Performs a sequence of register accesses, with one ioctl per TMC5130_SPIDEV_FRAMES_MAX datagrams.
+ * @param[in,out] accesses The accesses to perform, the data of read accesses is filled in.
+ * @param[in] count The number of accesses.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::register_batch(struct access *const accesses, const size_t count) {
+    tmc5130_lock_guard lock(m_lock);
+
+    /* Ensure setup has been done */
+    if (m_fd < 0) {
+        return -EINVAL;
+    }
+
+    /* Split into chunks leaving room for a trailing datagram */
+    for (size_t i = 0; i < count; i += TMC5130_SPIDEV_FRAMES_MAX - 1) {
+        size_t chunk = count - i;
+        if (chunk > TMC5130_SPIDEV_FRAMES_MAX - 1) {
+            chunk = TMC5130_SPIDEV_FRAMES_MAX - 1;
+        }
+        int res = frames_transfer(&accesses[i], chunk);
+        if (res < 0) {
+            return res;
+        }
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Sends one datagram per access, plus one to retrieve the data of a final read, in a single ioctl.
+ * Chip select is released between datagrams with cs_change, the spi core then keeps it released for 10 us before the next datagram.
+ * This gives read requests their gap with chip select released, as the Arduino transport does, which delay_usecs would not since it runs before the release.
+ * @param[in,out] accesses The accesses to perform, the data of read accesses is filled in.
+ * @param[in] count The number of accesses, at most TMC5130_SPIDEV_FRAMES_MAX - 1.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_spidev::frames_transfer(struct access *const accesses, const size_t count) {
+    uint8_t tx[TMC5130_SPIDEV_FRAMES_MAX][5];
+    uint8_t rx[TMC5130_SPIDEV_FRAMES_MAX][5];
+    struct spi_ioc_transfer transfers[TMC5130_SPIDEV_FRAMES_MAX];
+
+    /* Nothing to do */
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Build datagrams */
+    size_t frames = count;
+    memset(transfers, 0, sizeof(transfers));
+    for (size_t i = 0; i < count; i++) {
+        uint32_t data = accesses[i].write ? accesses[i].data : 0;
+        tx[i][0] = accesses[i].write ? (accesses[i].address | 0x80) : (accesses[i].address & 0x7F);
+        tx[i][1] = data >> 24;
+        tx[i][2] = data >> 16;
+        tx[i][3] = data >> 8;
+        tx[i][4] = data;
+    }
+    if (!accesses[count - 1].write) {
+        memcpy(tx[count], tx[count - 1], 5);
+        frames++;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        transfers[i].tx_buf = (unsigned long)tx[i];
+        transfers[i].rx_buf = (unsigned long)rx[i];
+        transfers[i].len = 5;
+        transfers[i].speed_hz = m_spi_speed;
+        transfers[i].bits_per_word = 8;
+        transfers[i].cs_change = (i + 1 < frames) ? 1 : 0;
+    }
+
+    /* Send them all at once */
+    if (m_io->ioctl(m_fd, SPI_IOC_MESSAGE(frames), transfers) < 0) {
+        TMC5130_TRACE_RECORD(accesses[0].address, (accesses[0].write ? tmc5130_trace::FLAG_WRITE : 0) | tmc5130_trace::FLAG_ERROR, 0xFF, accesses[0].data);
+        return -EIO;
+    }
+
+    /* Check status bytes and extract read data, which comes with the following datagram */
+    for (size_t i = 0; i < frames; i++) {
+        m_status_byte = rx[i][0];
+        if (m_status_byte == 0xFF) {
+            TMC5130_TRACE_RECORD(tx[i][0] & 0x7F, ((tx[i][0] & 0x80) ? tmc5130_trace::FLAG_WRITE : 0) | tmc5130_trace::FLAG_ERROR, m_status_byte, 0);
+            return -EIO;
+        }
+        if (i > 0 && !accesses[i - 1].write) {
+            accesses[i - 1].data = ((uint32_t)rx[i][1] << 24) | ((uint32_t)rx[i][2] << 16) | ((uint32_t)rx[i][3] << 8) | rx[i][4];
+            TMC5130_TRACE_RECORD(accesses[i - 1].address, (i < count) ? tmc5130_trace::FLAG_PIPELINED : 0, m_status_byte, accesses[i - 1].data);
+        }
+        if (i < count && accesses[i].write) {
+            TMC5130_TRACE_RECORD(accesses[i].address, tmc5130_trace::FLAG_WRITE, m_status_byte, accesses[i].data);
+        }
+    }
+
+    /* Return success */
+    return 0;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef TMC5130_SPIDEV_H
+#define TMC5130_SPIDEV_H
+
+/* Library header */
+#include "tmc5130.h"
+
+#if defined(__linux__)
+
+/* Maximum number of datagrams sent with a single ioctl, larger batches are split */
+#ifndef TMC5130_SPIDEV_FRAMES_MAX
+#define TMC5130_SPIDEV_FRAMES_MAX 32
+#endif
+
+/**
+ * File descriptor layer used by the spidev transport.
+ * The default implementation forwards to the system calls, it can be replaced to test the transport without hardware.
+ */
+class tmc5130_spidev_io {
+
+   public:
+    virtual ~tmc5130_spidev_io() {}
+    virtual int open(const char *const path, const int flags);
+    virtual int ioctl(const int fd, const unsigned long request, void *const argument);
+    virtual int close(const int fd);
+};
+
+/**
+ * Transport for Linux boards, through the spidev interface.
+ * Each register access, or batch of accesses, is sent with a single SPI_IOC_MESSAGE ioctl.
+ */
+class tmc5130_spidev : public tmc5130 {
+
+   public:
+    ~tmc5130_spidev();
+    int setup(struct config &config, const char *const device, const uint32_t spi_speed = 4000000, tmc5130_spidev_io *const io = NULL);
+    int setup(const struct setting *const settings, const size_t count, const char *const device, const uint32_t spi_speed = 4000000, tmc5130_spidev_io *const io = NULL);
+    int status_read(uint8_t &status);
+    int register_read(const uint8_t address, uint32_t &data);
+    int register_write(const uint8_t address, const uint32_t data);
+    int register_batch(struct access *const accesses, const size_t count);
+    size_t footprint_ram_get(void) const;
+
+   protected:
+    int transport_setup(const char *const device, const uint32_t spi_speed, tmc5130_spidev_io *const io);
+    int frames_transfer(struct access *const accesses, const size_t count);
+    tmc5130_spidev_io m_io_default;
+    tmc5130_spidev_io *m_io = NULL;
+    int m_fd = -1;
+    uint32_t m_spi_speed;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,124 @@
+/* Self header */
+#include "tmc5130_trace.h"
+
+/* C/C++ libraries */
+#include <errno.h>
+
+#if defined(ARDUINO)
+/**
+ * Default clock, wrapping micros() which may be a macro or have a different signature depending on the core.
+ */
+static uint32_t tmc5130_trace_micros(void) {
+    return micros();
+}
+#endif
+
+/**
+ *
+ * @param[in] buffer The ring buffer in which records are stored, must remain valid as long as the trace is used.
+ * @param[in] count The number of records the buffer can hold, at least 2.
+ * @param[in] overwrite If true, the oldest records are replaced when the buffer is full, otherwise new records are dropped.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If the buffer is not valid
+ */
+int tmc5130_trace::setup(struct entry *const buffer, const size_t count, const bool overwrite) {
+
+    /* Ensure buffer is valid */
+    if (buffer == NULL || count < 2) {
+        return -EINVAL;
+    }
+
+    /* Save parameters */
+    m_buffer = buffer;
+    m_count = count;
+    m_overwrite = overwrite;
+    m_head = 0;
+    m_tail = 0;
+    m_dropped = 0;
+#if defined(ARDUINO)
+    if (m_clock == NULL) {
+        m_clock = tmc5130_trace_micros;
+    }
+#endif
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Sets the function used to timestamp records, micros() by default on Arduino.
+ * @param[in] clock A function returning the time in microseconds, or NULL to leave timestamps at zero.
+ */
+void tmc5130_trace::clock_set(uint32_t (*const clock)(void)) {
+    m_clock = clock;
+}
+
+/**
+ * Adds a record, this is called by the transports.
+ * @param[in] address
+ * @param[in] flags
+ * @param[in] status
+ * @param[in] value
+ */
+void tmc5130_trace::record(const uint8_t address, const uint8_t flags, const uint8_t status, const uint32_t value) {
+
+    /* Ensure setup has been done */
+    if (m_buffer == NULL) {
+        return;
+    }
+
+    /* Make room */
+    size_t head_next = (m_head + 1) % m_count;
+    if (head_next == m_tail) {
+        m_dropped++;
+        if (!m_overwrite) {
+            return;
+        }
+        m_tail = (m_tail + 1) % m_count;
+    }
+
+    /* Store record */
+    struct entry &entry = m_buffer[m_head];
+    entry.timestamp = (m_clock != NULL) ? m_clock() : 0;
+    entry.address = address;
+    entry.flags = flags;
+    entry.status = status;
+    entry.value = value;
+    m_head = head_next;
+}
+
+/**
+ * Retrieves the oldest record.
+ * @param[out] entry
+ * @return 1 if a record was retrieved, 0 if there are none.
+ */
+int tmc5130_trace::read(struct entry &entry) {
+    if (m_buffer == NULL || m_tail == m_head) {
+        return 0;
+    }
+    entry = m_buffer[m_tail];
+    m_tail = (m_tail + 1) % m_count;
+    return 1;
+}
+
+#if defined(ARDUINO)
+/**
+ * Writes all records to the given output, in the binary format expected by extras/tmc5130_replay.py.
+ * @param[in] output For example Serial.
+ * @return The number of records written.
+ */
+int tmc5130_trace::stream(Print &output) {
+    int count = 0;
+    struct entry entry;
+    while (read(entry) == 1) {
+        uint8_t bytes[11] = {
+            (uint8_t)(entry.timestamp), (uint8_t)(entry.timestamp >> 8), (uint8_t)(entry.timestamp >> 16), (uint8_t)(entry.timestamp >> 24),
+            entry.address, entry.flags, entry.status,
+            (uint8_t)(entry.value), (uint8_t)(entry.value >> 8), (uint8_t)(entry.value >> 16), (uint8_t)(entry.value >> 24),
+        };
+        output.write(bytes, sizeof(bytes));
+        count++;
+    }
+    return count;
+}
+#endif
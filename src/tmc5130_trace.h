@@ -0,0 +1,58 @@
+#ifndef TMC5130_TRACE_H
+#define TMC5130_TRACE_H
+
+/* Arduino libraries */
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+/* C/C++ libraries */
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Records the register accesses put on the bus by a driver into a ram ring buffer.
+ *
+ * Recording, and the trace_attach function of the drivers, are only compiled in when TMC5130_TRACE is defined, for example with -DTMC5130_TRACE,
+ * so that builds without it do not pay for the trace pointer. The define changes the layout of the drivers, so it must be given to the whole build.
+ * Records can be streamed as 11-byte little endian entries (timestamp, address, flags, status, value),
+ * which extras/tmc5130_replay.py can replay against a simulated register file.
+ */
+class tmc5130_trace {
+
+   public:
+    enum flag {
+        FLAG_WRITE = 0x01,      // Register write, otherwise a register read
+        FLAG_STATUS = 0x02,     // Status byte read only, the address and value are not meaningful
+        FLAG_ERROR = 0x04,      // The access failed
+        FLAG_PIPELINED = 0x08,  // Read whose data came with the datagram of the next access of a batch, so it took a single datagram
+    };
+    struct entry {
+        uint32_t timestamp;  //!< Time of the access in microseconds
+        uint8_t address;     //!< Register address
+        uint8_t flags;       //!< Combination of flag values
+        uint8_t status;      //!< Status byte returned by the device
+        uint32_t value;      //!< Value written or read
+    };
+    int setup(struct entry *const buffer, const size_t count, const bool overwrite = true);
+    void clock_set(uint32_t (*const clock)(void));
+    void record(const uint8_t address, const uint8_t flags, const uint8_t status, const uint32_t value);
+    int read(struct entry &entry);
+#if defined(ARDUINO)
+    int stream(Print &output);
+#endif
+    uint32_t dropped_count(void) const {
+        return m_dropped;
+    }
+
+   protected:
+    struct entry *m_buffer = NULL;
+    size_t m_count = 0;
+    size_t m_head = 0;
+    size_t m_tail = 0;
+    bool m_overwrite = true;
+    uint32_t m_dropped = 0;
+    uint32_t (*m_clock)(void) = NULL;
+};
+
+#endif
@@ -0,0 +1,428 @@
+/* Self header */
+#include "tmc5130_tuner.h"
+
+/* Time allowed to reach each velocity of the sweep */
+#define TMC5130_TUNER_RAMP_TIMEOUT_US 5000000
+
+/* PWM_SCALE above which stealthChop is considered out of voltage */
+#define TMC5130_TUNER_PWM_SCALE_SATURATED 248
+
+/* Target slow decay time, a quarter of a 25 kHz chopper period */
+#define TMC5130_TUNER_TOFF_TARGET_S 10e-6f
+
+/**
+ *
+ * @param[in] driver The driver, which must have been setup.
+ * @param[in] config The configuration to start from, the tuned fields are replaced in the result.
+ * @param[in] velocity_max The highest velocity of the sweep, in steps/s.
+ * @param[in] points The number of velocities in the sweep, evenly spaced up to velocity_max.
+ * @param[in] settle_us The time to let the automatic scaling settle at each velocity, in microseconds.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If one of the parameters is not valid
+ */
+int tmc5130_tuner::setup(tmc5130 &driver, const struct tmc5130::config &config, const float velocity_max, const uint8_t points, const uint32_t settle_us) {
+
+    /* Ensure parameters are valid */
+    if (!(velocity_max > 0) || points < 2 || points > TMC5130_TUNER_POINTS_MAX) {
+        return -EINVAL;
+    }
+
+    /* Save parameters */
+    m_driver = &driver;
+    m_config = config;
+    m_velocity_max = velocity_max;
+    m_points = points;
+    m_settle_us = settle_us;
+    m_state = STATE_IDLE;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Gives the motor data used to compute the spreadCycle hysteresis, without it HSTRT and HEND are left unchanged.
+ * @param[in] motor The motor data, or NULL to forget it.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_tuner::motor_set(const struct motor *const motor) {
+    if (motor == NULL) {
+        m_motor_known = false;
+        return 0;
+    }
+    if (!(motor->supply_voltage > 0) || !(motor->coil_resistance > 0) || !(motor->coil_inductance > 0) || !(motor->current_peak > 0)) {
+        return -EINVAL;
+    }
+    m_motor = *motor;
+    m_motor_known = true;
+    return 0;
+}
+
+/**
+ * Configures the driver for the sweep and starts the motor at the first velocity.
+ * If this fails, the saved registers are written back right away, as the motor has not been started.
+ * @param[in] time_us The current time in microseconds, such as returned by micros().
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EINVAL If setup has not been done
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_tuner::start(const uint32_t time_us) {
+
+    /* Ensure setup has been done */
+    if (m_driver == NULL) {
+        return -EINVAL;
+    }
+
+    /* Save the registers overridden by the sweep */
+    if (registers_save() < 0) {
+        return -EIO;
+    }
+
+    /* Run in stealthChop with automatic scaling at every velocity */
+    union tmc5130::reg_gconf reg_gconf = m_config.reg_gconf;
+    reg_gconf.fields.en_pwm_mode = 1;
+    union tmc5130::reg_pwmconf reg_pwmconf = m_config.reg_pwmconf;
+    reg_pwmconf.fields.pwm_autoscale = 1;
+    union tmc5130::reg_chopconf reg_chopconf = m_config.reg_chopconf;
+    reg_chopconf.fields.mres = m_driver->m_mres;
+    reg_chopconf.fields.vhighfs = 0;
+    reg_chopconf.fields.vhighchm = 0;
+    int res = 0;
+    res |= m_driver->register_write(tmc5130::CHOPCONF, reg_chopconf.raw);
+    res |= m_driver->register_write(tmc5130::PWMCONF, reg_pwmconf.raw);
+    res |= m_driver->register_write(tmc5130::TPWMTHRS, 0);
+    res |= m_driver->register_write(tmc5130::THIGH, 0);
+    res |= m_driver->register_write(tmc5130::GCONF, reg_gconf.raw);
+    if (res < 0) {
+        registers_restore();
+        return -EIO;
+    }
+
+    /* Start the sweep */
+    m_index = 0;
+    m_time = time_us;
+    m_error = 0;
+    if (m_driver->move_at_velocity(velocity_get(0)) < 0) {
+        m_driver->move_stop();
+        registers_restore();
+        return -EIO;
+    }
+    m_state = STATE_RAMP;
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Advances the sweep, this should be called regularly until it returns 0.
+ * Once the sweep is over, or if it fails, the motor is stopped and the registers it overrode are written back once it stands still.
+ * Errors are therefore returned a few calls after they happened, once the motor stands still or did not within the ramp timeout.
+ * @param[in] time_us The current time in microseconds, such as returned by micros().
+ * @return 1 if the sweep is in progress, 0 once the result is available, or a negative error code otherwise, in particular:
+ *  -EINVAL If the sweep has not been started
+ *  -EIO If there was an error communicating with the device
+ *  -ETIMEDOUT If the motor did not reach a velocity of the sweep, or standstill, in time
+ *  -EFAULT If the driver reported an overtemperature or a short to ground
+ *  -ERANGE If stealthChop could not be used even at the lowest velocity of the sweep
+ */
+int tmc5130_tuner::update(const uint32_t time_us) {
+    int res;
+
+    switch (m_state) {
+
+        case STATE_RAMP: {
+            res = m_driver->target_velocity_reached_is();
+            if (res < 0) {
+                return sweep_abort(-EIO, time_us);
+            } else if (res == 1) {
+                m_time = time_us;
+                m_state = STATE_SETTLE;
+            } else if (time_us - m_time > TMC5130_TUNER_RAMP_TIMEOUT_US) {
+                return sweep_abort(-ETIMEDOUT, time_us);
+            }
+            return 1;
+        }
+
+        case STATE_SETTLE: {
+            if (time_us - m_time < m_settle_us) {
+                return 1;
+            }
+
+            /* Sample PWM_SCALE and DRV_STATUS */
+            union tmc5130::reg_pwm_scale reg_pwm_scale;
+            union tmc5130::reg_drv_status reg_drv_status;
+            if (m_driver->register_read(tmc5130::PWM_SCALE, reg_pwm_scale.raw) < 0 ||
+                m_driver->register_read(tmc5130::DRV_STATUS, reg_drv_status.raw) < 0) {
+                return sweep_abort(-EIO, time_us);
+            }
+            if (reg_drv_status.fields.ot || reg_drv_status.fields.s2ga || reg_drv_status.fields.s2gb) {
+                return sweep_abort(-EFAULT, time_us);
+            }
+
+            /* Open load flags in motion mean the current could not be regulated anymore */
+            m_pwm_scale[m_index] = reg_pwm_scale.fields.pwm_scale_sum;
+            m_saturated[m_index] = (reg_pwm_scale.fields.pwm_scale_sum >= TMC5130_TUNER_PWM_SCALE_SATURATED) || reg_drv_status.fields.ola || reg_drv_status.fields.olb;
+
+            /* Next velocity, or stop */
+            m_index++;
+            if (m_index < m_points) {
+                if (m_driver->move_at_velocity(velocity_get(m_index)) < 0) {
+                    return sweep_abort(-EIO, time_us);
+                }
+                m_time = time_us;
+                m_state = STATE_RAMP;
+                return 1;
+            }
+            if (m_driver->move_stop() < 0) {
+                return sweep_abort(-EIO, time_us);
+            }
+            m_time = time_us;
+            m_state = STATE_STOP;
+            return 1;
+        }
+
+        case STATE_STOP: {
+
+            /* Wait for standstill, then write the saved registers back */
+            res = standstill_is();
+            if (res == 0 && time_us - m_time <= TMC5130_TUNER_RAMP_TIMEOUT_US) {
+                return 1;
+            }
+            if (m_error == 0 && res < 0) {
+                m_error = -EIO;
+            } else if (m_error == 0 && res == 0) {
+                m_error = -ETIMEDOUT;
+            }
+            m_state = STATE_IDLE;
+            if (registers_restore() < 0 && m_error == 0) {
+                m_error = -EIO;
+            }
+            if (m_error < 0) {
+                return m_error;
+            }
+
+            /* Compute the result */
+            res = result_compute();
+            if (res < 0) {
+                return res;
+            }
+            m_state = STATE_DONE;
+            return 0;
+        }
+
+        case STATE_DONE: {
+            return 0;
+        }
+
+        default: {
+            return -EINVAL;
+        }
+    }
+}
+
+/**
+ * Retrieves the tuned configuration, which can be given to setup().
+ * @param[out] config
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EAGAIN If the sweep has not completed
+ */
+int tmc5130_tuner::result_get(struct tmc5130::config &config) {
+    if (m_state != STATE_DONE) {
+        return -EAGAIN;
+    }
+    config = m_config;
+    return 0;
+}
+
+/**
+ * Saves the registers overridden by the sweep.
+ * PWMCONF, TPWMTHRS and THIGH are write only, so their values are taken from the configuration given at setup.
+ * VSTART and VMAX are write only too, their values are the ones last written by the driver, which only remembers them when it has a microstep switching state.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_tuner::registers_save(void) {
+    int res = 0;
+    res |= m_driver->register_read(tmc5130::GCONF, m_saved_gconf.raw);
+    res |= m_driver->register_read(tmc5130::CHOPCONF, m_saved_chopconf.raw);
+    res |= m_driver->register_read(tmc5130::RAMPMODE, m_saved_rampmode);
+    if (res < 0) {
+        return -EIO;
+    }
+    m_saved_pwmconf = m_config.reg_pwmconf;
+    m_saved_tpwmthrs = m_config.reg_tpwmthrs;
+    m_saved_thigh = m_config.reg_thigh;
+    const int8_t index_vstart = tmc5130::ramp_index(tmc5130::VSTART);
+    const int8_t index_vmax = tmc5130::ramp_index(tmc5130::VMAX);
+    m_saved_ramp = (m_driver->m_microstep != NULL && (m_driver->m_microstep->valid & (1 << index_vstart)) && (m_driver->m_microstep->valid & (1 << index_vmax)));
+    if (m_saved_ramp) {
+        m_saved_vstart = m_driver->m_microstep->ramp[index_vstart];
+        m_saved_vmax = m_driver->m_microstep->ramp[index_vmax];
+    }
+    return 0;
+}
+
+/**
+ * Writes the registers saved at the beginning of the sweep back, while keeping the motor at standstill.
+ * RAMPMODE is written back whatever it was, in positioning mode after moving the target to the actual position so that restoring VMAX does not start a move.
+ * In velocity mode VMAX is left at 0, as restoring it would start the motor, and if VSTART and VMAX could not be saved they are left at 0 as well,
+ * the speed limit must then be set again.
+ * The microstep resolution in use is kept, since the driver may have switched it during the sweep.
+ * @return 0 in case of success, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_tuner::registers_restore(void) {
+    int res = 0;
+
+    /* Chopper configuration */
+    union tmc5130::reg_chopconf reg_chopconf = m_saved_chopconf;
+    reg_chopconf.fields.mres = m_driver->m_mres;
+    res |= m_driver->register_write(tmc5130::CHOPCONF, reg_chopconf.raw);
+    res |= m_driver->register_write(tmc5130::PWMCONF, m_saved_pwmconf.raw);
+    res |= m_driver->register_write(tmc5130::TPWMTHRS, m_saved_tpwmthrs.raw);
+    res |= m_driver->register_write(tmc5130::THIGH, m_saved_thigh.raw);
+    res |= m_driver->register_write(tmc5130::GCONF, m_saved_gconf.raw);
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Ramp mode and limits */
+    if ((m_saved_rampmode & 0x03) == 0) {
+        uint32_t xactual;
+        res |= m_driver->register_read(tmc5130::XACTUAL, xactual);
+        res |= m_driver->register_write(tmc5130::XTARGET, xactual);
+    }
+    res |= m_driver->register_write(tmc5130::RAMPMODE, m_saved_rampmode & 0x03);
+    if (m_saved_ramp && (m_saved_rampmode & 0x03) != 1 && (m_saved_rampmode & 0x03) != 2) {
+        res |= m_driver->ramp_write(tmc5130::VMAX, m_saved_vmax);
+    }
+    if (m_saved_ramp) {
+        res |= m_driver->ramp_write(tmc5130::VSTART, m_saved_vstart);
+    }
+    if (res < 0) {
+        return -EIO;
+    }
+
+    /* Return success */
+    return 0;
+}
+
+/**
+ * Stops the sweep after a failure, the saved registers are written back and the error returned once the motor stands still.
+ * @param[in] error The error to return.
+ * @param[in] time_us The current time in microseconds.
+ * @return 1, as the sweep is still in progress until the motor stands still.
+ */
+int tmc5130_tuner::sweep_abort(const int error, const uint32_t time_us) {
+    m_driver->move_stop();
+    m_error = error;
+    m_time = time_us;
+    m_state = STATE_STOP;
+    return 1;
+}
+
+/**
+ *
+ * @return 1 if the motor stands still, 0 if it is moving, or a negative error code otherwise, in particular:
+ *  -EIO If there was an error communicating with the device
+ */
+int tmc5130_tuner::standstill_is(void) {
+    uint32_t reg_vactual;
+    if (m_driver->register_read(tmc5130::VACTUAL, reg_vactual) < 0) {
+        return -EIO;
+    }
+    return ((reg_vactual & 0x00FFFFFF) == 0) ? 1 : 0;
+}
+
+/**
+ *
+ * @param[in] index
+ * @return The velocity of the sweep at the given index, in steps/s.
+ */
+float tmc5130_tuner::velocity_get(const uint8_t index) const {
+    return m_velocity_max * (index + 1) / m_points;
+}
+
+/**
+ * Derives the chopper settings from the sweep, replacing them in m_config.
+ * @return 0 in case of success, or a negative error code otherwise.
+ */
+int tmc5130_tuner::result_compute(void) {
+    const float fclk = m_driver->m_fclk;
+
+    /* Fit PWM_SCALE = PWM_AMPL + PWM_GRAD * 256 / TSTEP over the points where stealthChop could regulate
+     * @see Datasheet, PWMCONF register description */
+    float sx = 0, sy = 0, sxx = 0, sxy = 0;
+    uint8_t n = 0;
+    float velocity_stealth = 0;
+    for (uint8_t i = 0; i < m_points; i++) {
+        if (m_saturated[i]) break;
+        float x = 256.0f / (float)m_driver->convert_velocity_to_tstep(velocity_get(i));
+        float y = m_pwm_scale[i];
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        n++;
+        velocity_stealth = velocity_get(i);
+    }
+    if (n < 2) {
+        return -ERANGE;
+    }
+    float grad = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    float ampl = (sy - grad * sx) / n;
+    if (!(grad > 0)) grad = 0;
+    if (!(ampl > 0)) ampl = 0;
+    m_config.reg_pwmconf.fields.pwm_autoscale = 0;
+    m_config.reg_pwmconf.fields.pwm_ampl = (ampl > 255) ? 255 : (uint8_t)roundf(ampl);
+    m_config.reg_pwmconf.fields.pwm_grad = (grad > 255) ? 255 : (uint8_t)roundf(grad);
+    m_config.reg_gconf.fields.en_pwm_mode = 1;
+
+    /* Leave stealthChop with some margin below the highest velocity it handled, unless it handled the whole sweep */
+    if (n < m_points) {
+        velocity_stealth *= 0.9f;
+    }
+    m_config.reg_tpwmthrs.fields.tpwmthrs = m_driver->convert_velocity_to_tstep(velocity_stealth);
+
+    /* Switch to fullstep once a sine wave would need about sqrt(2) times the available amplitude */
+    float velocity_high = 0;
+    if (grad > 0) {
+        float x = (255.0f * 1.414f - ampl) / grad;
+        velocity_high = x * fclk / 65536.0f;
+    }
+    if (!(velocity_high > velocity_stealth * 1.5f)) {
+        velocity_high = velocity_stealth * 1.5f;
+    }
+    m_config.reg_thigh.fields.thigh = m_driver->convert_velocity_to_tstep(velocity_high);
+    m_config.reg_chopconf.fields.mres = m_driver->m_mres;
+    m_config.reg_chopconf.fields.vhighfs = 1;
+    m_config.reg_chopconf.fields.vhighchm = 1;
+
+    /* Slow decay time: tOFF = (24 + 32 * TOFF) / fCLK */
+    float toff = roundf((TMC5130_TUNER_TOFF_TARGET_S * fclk - 24.0f) / 32.0f);
+    toff = (toff < 2) ? 2 : (toff > 15) ? 15 : toff;
+    m_config.reg_chopconf.fields.toff = (uint8_t)toff;
+
+    /* spreadCycle hysteresis from the current ripple during blank time and slow decay
+     * @see Datasheet, calculation of a spreadCycle hysteresis */
+    if (m_motor_known) {
+        static const uint8_t blank_clocks[4] = {16, 24, 36, 54};
+        float t_blank = blank_clocks[m_config.reg_chopconf.fields.tbl & 0x03] / fclk;
+        float t_off = (24.0f + 32.0f * toff) / fclk;
+        float di_blank = m_motor.supply_voltage * t_blank / m_motor.coil_inductance;
+        float di_off = m_motor.coil_resistance * m_motor.current_peak * 2.0f * t_off / m_motor.coil_inductance;
+        int16_t hysteresis = (int16_t)ceilf((di_blank + di_off) * 2.0f * 248.0f / m_motor.current_peak);
+        hysteresis = (hysteresis < 1) ? 1 : (hysteresis > 15) ? 15 : hysteresis;
+        int16_t hend = hysteresis / 2;
+        int16_t hstrt = hysteresis - hend;
+        if (hstrt > 8) {
+            hstrt = 8;
+            hend = hysteresis - hstrt;
+        }
+        m_config.reg_chopconf.fields.hstrt = hstrt - 1;  // HSTRT register value is offset by 1
+        m_config.reg_chopconf.fields.hend = hend + 3;    // HEND register value is offset by -3
+        m_config.reg_chopconf.fields.chm = 0;
+    }
+
+    /* Return success */
+    return 0;
+}
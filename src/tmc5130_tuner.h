@@ -0,0 +1,77 @@
+#ifndef TMC5130_TUNER_H
+#define TMC5130_TUNER_H
+
+/* Library header */
+#include "tmc5130.h"
+
+/* Maximum number of velocities in the sweep */
+#ifndef TMC5130_TUNER_POINTS_MAX
+#define TMC5130_TUNER_POINTS_MAX 16
+#endif
+
+/**
+ * Tunes the stealthChop and spreadCycle chopper settings by running the motor through a velocity sweep.
+ *
+ * At each velocity of the sweep, the motor runs in stealthChop with automatic scaling, and PWM_SCALE and DRV_STATUS are read once the velocity is stable.
+ * From these, the tuner derives:
+ * - PWM_AMPL and PWM_GRAD, from a linear fit of PWM_SCALE against velocity, for stealthChop without automatic scaling,
+ * - TPWMTHRS, below the velocity at which stealthChop runs out of voltage,
+ * - THIGH, above which the driver switches to fullstep,
+ * - TOFF from the clock frequency, and HSTRT/HEND from the motor data if it is given.
+ * The registers overridden by the sweep are written back once it finishes or fails, leaving the motor at standstill.
+ * @note The motor must be free to turn in the positive direction during the sweep.
+ */
+class tmc5130_tuner {
+
+   public:
+    struct motor {
+        float supply_voltage;   //!< Motor supply voltage in V
+        float coil_resistance;  //!< Coil resistance in Ω
+        float coil_inductance;  //!< Coil inductance in H
+        float current_peak;     //!< Peak coil current at the run current, in A
+    };
+    int setup(tmc5130 &driver, const struct tmc5130::config &config, const float velocity_max, const uint8_t points = 8, const uint32_t settle_us = 300000);
+    int motor_set(const struct motor *const motor);
+    int start(const uint32_t time_us);
+    int update(const uint32_t time_us);
+    int result_get(struct tmc5130::config &config);
+
+   protected:
+    enum state {
+        STATE_IDLE,
+        STATE_RAMP,
+        STATE_SETTLE,
+        STATE_STOP,
+        STATE_DONE,
+    };
+    float velocity_get(const uint8_t index) const;
+    int result_compute(void);
+    int registers_save(void);
+    int registers_restore(void);
+    int sweep_abort(const int error, const uint32_t time_us);
+    int standstill_is(void);
+    tmc5130 *m_driver = NULL;
+    struct tmc5130::config m_config;
+    struct motor m_motor;
+    bool m_motor_known = false;
+    float m_velocity_max;
+    uint8_t m_points;
+    uint32_t m_settle_us;
+    enum state m_state = STATE_IDLE;
+    uint8_t m_index;
+    uint32_t m_time;
+    int m_error;  //!< Error that stopped the sweep, returned once the motor stands still
+    uint8_t m_pwm_scale[TMC5130_TUNER_POINTS_MAX];
+    bool m_saturated[TMC5130_TUNER_POINTS_MAX];
+    union tmc5130::reg_gconf m_saved_gconf;  //!< Registers overridden by the sweep, to write back once it is over
+    union tmc5130::reg_chopconf m_saved_chopconf;
+    union tmc5130::reg_pwmconf m_saved_pwmconf;
+    union tmc5130::reg_tpwmthrs m_saved_tpwmthrs;
+    union tmc5130::reg_thigh m_saved_thigh;
+    uint32_t m_saved_rampmode;
+    bool m_saved_ramp;  //!< Whether VSTART and VMAX could be saved, from the ramp registers remembered by the driver
+    uint32_t m_saved_vstart;
+    uint32_t m_saved_vmax;
+};
+
+#endif